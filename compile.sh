@@ -2,11 +2,22 @@
 
 echo "static const char * BUILD_TIMESTAMP=\"`date`\";" > build_timestamp.h
 
-em++ -Wall -Wextra -O3 -std=c++11 -s USE_SDL=2 -s WASM=1 ./main.cpp -o wave.js \
+# wave.js is the scalar build and runs everywhere
+# "./compile.sh simd" also builds wave-simd.js with the WASM SIMD kernels, for browsers that support them
+build() {
+em++ -Wall -Wextra -O3 -std=c++11 $1 -s USE_SDL=2 -s WASM=1 ./main.cpp -o $2 \
     -s EXPORTED_FUNCTIONS='["_getText", "_getSampleRate", "_setText", "_getAverageRxTime_ms", "_setParameters",
                             "_getFramesLeftToRecord", "_getFramesToRecord",
                             "_getFramesLeftToAnalyze", "_getFramesToAnalyze",
                             "_hasDeviceOutput", "_hasDeviceCapture", "_doInit",
-                            "_setTxMode",
+                            "_setTxMode", "_getCaptureOverruns", "_getMemoryFootprint_bytes", "_getWaveformCacheHits", "_getWaveformCacheMisses", "_getRSCodecAllocations",
+                            "_getTextLength", "_getLongText",
                             "_main"]' \
     -s EXTRA_EXPORTED_RUNTIME_METHODS='["ccall", "cwrap", "writeArrayToMemory"]'
+}
+
+build "" wave.js
+
+if [ "$1" == "simd" ] ; then
+    build "-msimd128" wave-simd.js
+fi
@@ -4,6 +4,7 @@
  */
 
 #include "reed-solomon/rs.hpp"
+#include "soft-decode.hpp"
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_audio.h>
@@ -16,17 +17,32 @@
 #include <ctime>
 #include <algorithm>
 #include <map>
+#include <list>
+#include <unordered_map>
 #include <complex>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846f
 #endif
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
 #ifdef __EMSCRIPTEN__
 #include "build_timestamp.h"
 #include "emscripten/emscripten.h"
 #else
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
 #endif
 
@@ -46,6 +62,7 @@ static SDL_AudioDeviceID devid_out = 0;
 
 struct DataRxTx;
 static DataRxTx *g_data = nullptr;
+static DataRxTx *g_dataTx = nullptr;
 
 namespace {
 
@@ -54,11 +71,20 @@ constexpr auto kMaxSamplesPerFrame = 1024;
 constexpr auto kMaxDataBits = 256;
 constexpr auto kMaxDataSize = 256;
 constexpr auto kMaxLength = 140;
+constexpr auto kMaxLongLength = 2048;
+constexpr auto kMaxHeaderLength = 6;
+constexpr auto kMaxEncodedSize = 4096;
 constexpr auto kMaxSpectrumHistory = 4;
-constexpr auto kMaxRecordedFrames = 64*10;
+constexpr auto kStepsPerFrame = 16;
+constexpr auto kSyncCandidates = 8;
+constexpr auto kChaseBudget_ms = 200;
+constexpr auto kCaptureRingSize = 64*kMaxSamplesPerFrame;
+constexpr auto kPlaybackRingSize = 8*kMaxSamplesPerFrame;
+constexpr auto kWaveformCacheSize_bytes = 4*1024*1024;
 constexpr auto kDefaultFixedLength = 82;
+constexpr auto kDefaultFixedECCLength = 32;
 
-// FFT routines taken from https://stackoverflow.com/a/37729648/4039976
+// FFT routines originally taken from https://stackoverflow.com/a/37729648/4039976
 
 int log2(int N) {
     int k = N, i = 0;
@@ -69,64 +95,979 @@ int log2(int N) {
     return i - 1;
 }
 
-int check(int n) {
-    return n > 0 && (n & (n - 1)) == 0;
+// Precomputed data for an N-point radix-2 transform
+struct FFTPlan {
+    int N = 0;
+    int log2N = 0;
+
+    std::vector<std::complex<float>> twiddles;      // exp(-2*pi*i*k/N), k < N/2
+    std::vector<std::complex<float>> stageTwiddles; // exp(-2*pi*i*j/(2*n)), j < n, stored at offset n - 1 for n = 1, 2, 4, ..., N/2
+    std::vector<int> bitReversed;                   // bit-reversal permutation of [0, N)
+};
+
+FFTPlan makeFFTPlan(int N) {
+    FFTPlan plan;
+    plan.N = N;
+    plan.log2N = log2(N);
+
+    plan.twiddles.resize(std::max(1, N/2));
+    for (int k = 0; k < N/2; ++k) {
+        plan.twiddles[k] = std::polar(1.0, -2.0*M_PI*k/N);
+    }
+
+    plan.stageTwiddles.resize(std::max(1, N - 1));
+    for (int n = 1; n < N; n *= 2) {
+        for (int j = 0; j < n; ++j) {
+            plan.stageTwiddles[n - 1 + j] = std::polar(1.0, -M_PI*j/n);
+        }
+    }
+
+    plan.bitReversed.resize(N);
+    for (int i = 0; i < N; ++i) {
+        int p = 0;
+        for (int j = 0; j < plan.log2N; ++j) {
+            if (i & (1 << j)) p |= 1 << (plan.log2N - j - 1);
+        }
+        plan.bitReversed[i] = p;
+    }
+
+    return plan;
+}
+
+// Plans are built once for all power-of-two sizes up to kMaxSamplesPerFrame
+const FFTPlan & getFFTPlan(int N) {
+    static const std::vector<FFTPlan> plans = [] {
+        std::vector<FFTPlan> res;
+        for (int n = 1; n <= kMaxSamplesPerFrame; n *= 2) {
+            res.push_back(makeFFTPlan(n));
+        }
+        return res;
+    }();
+
+    return plans[log2(N)];
 }
 
-int reverse(int N, int n) {
-    int j, p = 0;
-    for(j = 1; j <= log2(N); j++) {
-        if(n & (1 << (log2(N) - j)))
-            p |= 1 << (j - 1);
+inline std::complex<float> cmul(const std::complex<float> & a, const std::complex<float> & b) {
+    return std::complex<float>(a.real()*b.real() - a.imag()*b.imag(), a.real()*b.imag() + a.imag()*b.real());
+}
+
+// A radix-2^2 pass fuses the radix-2 stages with half-sizes n and 2*n, so each
+// group of 4 points is loaded and stored once per two stages:
+//
+//   b0 = a0 + wn[j]*a1, b1 = a0 - wn[j]*a1, b2 = a2 + wn[j]*a3, b3 = a2 - wn[j]*a3
+//   a0 = b0 + w2n[j]*b2, a2 = b0 - w2n[j]*b2, a1 = b1 - i*w2n[j]*b3, a3 = b1 + i*w2n[j]*b3
+//
+// where ak = f[i + j + k*n]. The SIMD kernels vectorize over j and fall back to
+// the scalar kernel for the first passes, where n is smaller than the vector width
+using FFTPass4 = void (*)(std::complex<float>* f, int N, int n, const std::complex<float>* wn, const std::complex<float>* w2n);
+
+void fftPass4Scalar(std::complex<float>* f, int N, int n, const std::complex<float>* wn, const std::complex<float>* w2n) {
+    for (int i = 0; i < N; i += 4*n) {
+        for (int j = 0; j < n; ++j) {
+            std::complex<float> * p = f + i + j;
+
+            const auto t1 = cmul(wn[j], p[n]);
+            const auto t3 = cmul(wn[j], p[3*n]);
+
+            const auto b0 = p[0] + t1;
+            const auto b1 = p[0] - t1;
+            const auto b2 = p[2*n] + t3;
+            const auto b3 = p[2*n] - t3;
+
+            const auto u2 = cmul(w2n[j], b2);
+            const auto u3 = cmul(w2n[j], b3);
+            const std::complex<float> v3(u3.imag(), -u3.real()); // -i*u3
+
+            p[0]   = b0 + u2;
+            p[2*n] = b0 - u2;
+            p[n]   = b1 + v3;
+            p[3*n] = b1 - v3;
+        }
+    }
+}
+
+// Two dot products sharing the same input: ra = sum(x*a), rb = sum(x*b).
+// n must be a multiple of 8
+using Dot2 = void (*)(const float * x, const float * a, const float * b, int n, float & ra, float & rb);
+
+void dot2Scalar(const float * x, const float * a, const float * b, int n, float & ra, float & rb) {
+    float sa[4] = { 0.0f };
+    float sb[4] = { 0.0f };
+    for (int i = 0; i < n; i += 4) {
+        for (int l = 0; l < 4; ++l) {
+            sa[l] += x[i + l]*a[i + l];
+            sb[l] += x[i + l]*b[i + l];
+        }
+    }
+    ra = (sa[0] + sa[1]) + (sa[2] + sa[3]);
+    rb = (sb[0] + sb[1]) + (sb[2] + sb[3]);
+}
+
+// Mixes the tones of a Tx frame: dst = gain*env*sum(tones), rounded to the
+// nearest integer and saturated to int16
+using MixFrame = void (*)(const float * const * tones, int nTones, const float * env, float gain, int16_t * dst, int n);
+
+inline int16_t toInt16(float x) {
+    return std::max(-32768.0f, std::min(32767.0f, std::nearbyint(x)));
+}
+
+// samples [i0, n) of the frame, also used for the tails of the SIMD kernels
+void mixFrameRange(const float * const * tones, int nTones, const float * env, float gain, int16_t * dst, int i0, int n) {
+    for (int i = i0; i < n; ++i) {
+        float sum = 0.0f;
+        for (int t = 0; t < nTones; ++t) {
+            sum += tones[t][i];
+        }
+        dst[i] = toInt16(gain*env[i]*sum);
+    }
+}
+
+void mixFrameScalar(const float * const * tones, int nTones, const float * env, float gain, int16_t * dst, int n) {
+    mixFrameRange(tones, nTones, env, gain, dst, 0, n);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86_DISPATCH
+
+__attribute__((target("sse3")))
+inline float hsumSse3(__m128 v) {
+    v = _mm_hadd_ps(v, v);
+    v = _mm_hadd_ps(v, v);
+    return _mm_cvtss_f32(v);
+}
+
+// complex multiply of 2 interleaved (re, im) pairs
+__attribute__((target("sse3")))
+inline __m128 cmulSse3(__m128 a, __m128 w) {
+    const __m128 wr = _mm_moveldup_ps(w);
+    const __m128 wi = _mm_movehdup_ps(w);
+    const __m128 as = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_addsub_ps(_mm_mul_ps(a, wr), _mm_mul_ps(as, wi));
+}
+
+__attribute__((target("sse3")))
+void fftPass4Sse3(std::complex<float>* f, int N, int n, const std::complex<float>* wn, const std::complex<float>* w2n) {
+    if (n < 2) return fftPass4Scalar(f, N, n, wn, w2n);
+
+    float * d = reinterpret_cast<float *>(f);
+    const float * fwn = reinterpret_cast<const float *>(wn);
+    const float * fw2n = reinterpret_cast<const float *>(w2n);
+    const __m128 negIm = _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f);
+
+    for (int i = 0; i < N; i += 4*n) {
+        for (int j = 0; j < n; j += 2) {
+            float * p = d + 2*(i + j);
+
+            const __m128 w = _mm_loadu_ps(fwn + 2*j);
+            const __m128 v = _mm_loadu_ps(fw2n + 2*j);
+
+            const __m128 a0 = _mm_loadu_ps(p);
+            const __m128 t1 = cmulSse3(_mm_loadu_ps(p + 2*n), w);
+            const __m128 a2 = _mm_loadu_ps(p + 4*n);
+            const __m128 t3 = cmulSse3(_mm_loadu_ps(p + 6*n), w);
+
+            const __m128 b0 = _mm_add_ps(a0, t1);
+            const __m128 b1 = _mm_sub_ps(a0, t1);
+            const __m128 u2 = cmulSse3(_mm_add_ps(a2, t3), v);
+            const __m128 u3 = cmulSse3(_mm_sub_ps(a2, t3), v);
+            const __m128 v3 = _mm_xor_ps(_mm_shuffle_ps(u3, u3, _MM_SHUFFLE(2, 3, 0, 1)), negIm);
+
+            _mm_storeu_ps(p,       _mm_add_ps(b0, u2));
+            _mm_storeu_ps(p + 4*n, _mm_sub_ps(b0, u2));
+            _mm_storeu_ps(p + 2*n, _mm_add_ps(b1, v3));
+            _mm_storeu_ps(p + 6*n, _mm_sub_ps(b1, v3));
+        }
+    }
+}
+
+__attribute__((target("sse3")))
+void dot2Sse3(const float * x, const float * a, const float * b, int n, float & ra, float & rb) {
+    __m128 sa0 = _mm_setzero_ps(), sa1 = _mm_setzero_ps();
+    __m128 sb0 = _mm_setzero_ps(), sb1 = _mm_setzero_ps();
+    for (int i = 0; i < n; i += 8) {
+        const __m128 x0 = _mm_loadu_ps(x + i);
+        const __m128 x1 = _mm_loadu_ps(x + i + 4);
+        sa0 = _mm_add_ps(sa0, _mm_mul_ps(x0, _mm_loadu_ps(a + i)));
+        sa1 = _mm_add_ps(sa1, _mm_mul_ps(x1, _mm_loadu_ps(a + i + 4)));
+        sb0 = _mm_add_ps(sb0, _mm_mul_ps(x0, _mm_loadu_ps(b + i)));
+        sb1 = _mm_add_ps(sb1, _mm_mul_ps(x1, _mm_loadu_ps(b + i + 4)));
+    }
+    ra = hsumSse3(_mm_add_ps(sa0, sa1));
+    rb = hsumSse3(_mm_add_ps(sb0, sb1));
+}
+
+__attribute__((target("sse3")))
+void mixFrameSse3(const float * const * tones, int nTones, const float * env, float gain, int16_t * dst, int n) {
+    const __m128 g = _mm_set1_ps(gain);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128 s0 = _mm_setzero_ps();
+        __m128 s1 = _mm_setzero_ps();
+        for (int t = 0; t < nTones; ++t) {
+            s0 = _mm_add_ps(s0, _mm_loadu_ps(tones[t] + i));
+            s1 = _mm_add_ps(s1, _mm_loadu_ps(tones[t] + i + 4));
+        }
+        const __m128i r0 = _mm_cvtps_epi32(_mm_mul_ps(_mm_mul_ps(g, _mm_loadu_ps(env + i)), s0));
+        const __m128i r1 = _mm_cvtps_epi32(_mm_mul_ps(_mm_mul_ps(g, _mm_loadu_ps(env + i + 4)), s1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packs_epi32(r0, r1));
     }
-    return p;
+    mixFrameRange(tones, nTones, env, gain, dst, i, n);
 }
 
-void ordina(std::complex<float>* f1, int N) {
-    std::complex<float> f2[kMaxSamplesPerFrame];
-    for(int i = 0; i < N; i++)
-        f2[i] = f1[reverse(N, i)];
-    for(int j = 0; j < N; j++)
-        f1[j] = f2[j];
+// complex multiply of 4 interleaved (re, im) pairs
+__attribute__((target("avx2,fma")))
+inline __m256 cmulAvx2(__m256 a, __m256 w) {
+    const __m256 wr = _mm256_moveldup_ps(w);
+    const __m256 wi = _mm256_movehdup_ps(w);
+    const __m256 as = _mm256_permute_ps(a, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm256_fmaddsub_ps(a, wr, _mm256_mul_ps(as, wi));
 }
 
-void transform(std::complex<float>* f, int N) {
-    ordina(f, N);    //first: reverse order
-    std::complex<float> *W;
-    W = (std::complex<float> *)malloc(N / 2 * sizeof(std::complex<float>));
-    W[1] = std::polar(1., -2. * M_PI / N);
-    W[0] = 1;
-    for(int i = 2; i < N / 2; i++)
-        W[i] = pow(W[1], i);
+__attribute__((target("avx2,fma")))
+void fftPass4Avx2(std::complex<float>* f, int N, int n, const std::complex<float>* wn, const std::complex<float>* w2n) {
+    if (n < 4) return fftPass4Sse3(f, N, n, wn, w2n);
+
+    float * d = reinterpret_cast<float *>(f);
+    const float * fwn = reinterpret_cast<const float *>(wn);
+    const float * fw2n = reinterpret_cast<const float *>(w2n);
+    const __m256 negIm = _mm256_set_ps(-0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f);
+
+    for (int i = 0; i < N; i += 4*n) {
+        for (int j = 0; j < n; j += 4) {
+            float * p = d + 2*(i + j);
+
+            const __m256 w = _mm256_loadu_ps(fwn + 2*j);
+            const __m256 v = _mm256_loadu_ps(fw2n + 2*j);
+
+            const __m256 a0 = _mm256_loadu_ps(p);
+            const __m256 t1 = cmulAvx2(_mm256_loadu_ps(p + 2*n), w);
+            const __m256 a2 = _mm256_loadu_ps(p + 4*n);
+            const __m256 t3 = cmulAvx2(_mm256_loadu_ps(p + 6*n), w);
+
+            const __m256 b0 = _mm256_add_ps(a0, t1);
+            const __m256 b1 = _mm256_sub_ps(a0, t1);
+            const __m256 u2 = cmulAvx2(_mm256_add_ps(a2, t3), v);
+            const __m256 u3 = cmulAvx2(_mm256_sub_ps(a2, t3), v);
+            const __m256 v3 = _mm256_xor_ps(_mm256_permute_ps(u3, _MM_SHUFFLE(2, 3, 0, 1)), negIm);
+
+            _mm256_storeu_ps(p,       _mm256_add_ps(b0, u2));
+            _mm256_storeu_ps(p + 4*n, _mm256_sub_ps(b0, u2));
+            _mm256_storeu_ps(p + 2*n, _mm256_add_ps(b1, v3));
+            _mm256_storeu_ps(p + 6*n, _mm256_sub_ps(b1, v3));
+        }
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void dot2Avx2(const float * x, const float * a, const float * b, int n, float & ra, float & rb) {
+    __m256 sa = _mm256_setzero_ps();
+    __m256 sb = _mm256_setzero_ps();
+    for (int i = 0; i < n; i += 8) {
+        const __m256 xi = _mm256_loadu_ps(x + i);
+        sa = _mm256_fmadd_ps(xi, _mm256_loadu_ps(a + i), sa);
+        sb = _mm256_fmadd_ps(xi, _mm256_loadu_ps(b + i), sb);
+    }
+    ra = hsumSse3(_mm_add_ps(_mm256_castps256_ps128(sa), _mm256_extractf128_ps(sa, 1)));
+    rb = hsumSse3(_mm_add_ps(_mm256_castps256_ps128(sb), _mm256_extractf128_ps(sb, 1)));
+}
+
+__attribute__((target("avx2,fma")))
+void mixFrameAvx2(const float * const * tones, int nTones, const float * env, float gain, int16_t * dst, int n) {
+    const __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 s = _mm256_setzero_ps();
+        for (int t = 0; t < nTones; ++t) {
+            s = _mm256_add_ps(s, _mm256_loadu_ps(tones[t] + i));
+        }
+        const __m256i r = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_mul_ps(g, _mm256_loadu_ps(env + i)), s));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_packs_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1)));
+    }
+    mixFrameRange(tones, nTones, env, gain, dst, i, n);
+}
+
+#elif defined(__wasm_simd128__)
+
+// complex multiply of 2 interleaved (re, im) pairs
+inline v128_t cmulWasm(v128_t a, v128_t w) {
+    const v128_t wr = wasm_i32x4_shuffle(w, w, 0, 0, 2, 2);
+    const v128_t wi = wasm_i32x4_shuffle(w, w, 1, 1, 3, 3);
+    const v128_t as = wasm_i32x4_shuffle(a, a, 1, 0, 3, 2);
+    const v128_t sign = wasm_f32x4_make(-1.0f, 1.0f, -1.0f, 1.0f);
+    return wasm_f32x4_add(wasm_f32x4_mul(a, wr), wasm_f32x4_mul(wasm_f32x4_mul(as, wi), sign));
+}
+
+void fftPass4Wasm(std::complex<float>* f, int N, int n, const std::complex<float>* wn, const std::complex<float>* w2n) {
+    if (n < 2) return fftPass4Scalar(f, N, n, wn, w2n);
+
+    float * d = reinterpret_cast<float *>(f);
+    const float * fwn = reinterpret_cast<const float *>(wn);
+    const float * fw2n = reinterpret_cast<const float *>(w2n);
+    const v128_t negIm = wasm_f32x4_make(0.0f, -0.0f, 0.0f, -0.0f);
+
+    for (int i = 0; i < N; i += 4*n) {
+        for (int j = 0; j < n; j += 2) {
+            float * p = d + 2*(i + j);
+
+            const v128_t w = wasm_v128_load(fwn + 2*j);
+            const v128_t v = wasm_v128_load(fw2n + 2*j);
+
+            const v128_t a0 = wasm_v128_load(p);
+            const v128_t t1 = cmulWasm(wasm_v128_load(p + 2*n), w);
+            const v128_t a2 = wasm_v128_load(p + 4*n);
+            const v128_t t3 = cmulWasm(wasm_v128_load(p + 6*n), w);
+
+            const v128_t b0 = wasm_f32x4_add(a0, t1);
+            const v128_t b1 = wasm_f32x4_sub(a0, t1);
+            const v128_t u2 = cmulWasm(wasm_f32x4_add(a2, t3), v);
+            const v128_t u3 = cmulWasm(wasm_f32x4_sub(a2, t3), v);
+            const v128_t v3 = wasm_v128_xor(wasm_i32x4_shuffle(u3, u3, 1, 0, 3, 2), negIm);
+
+            wasm_v128_store(p,       wasm_f32x4_add(b0, u2));
+            wasm_v128_store(p + 4*n, wasm_f32x4_sub(b0, u2));
+            wasm_v128_store(p + 2*n, wasm_f32x4_add(b1, v3));
+            wasm_v128_store(p + 6*n, wasm_f32x4_sub(b1, v3));
+        }
+    }
+}
+
+void dot2Wasm(const float * x, const float * a, const float * b, int n, float & ra, float & rb) {
+    v128_t sa = wasm_f32x4_splat(0.0f);
+    v128_t sb = wasm_f32x4_splat(0.0f);
+    for (int i = 0; i < n; i += 4) {
+        const v128_t xi = wasm_v128_load(x + i);
+        sa = wasm_f32x4_add(sa, wasm_f32x4_mul(xi, wasm_v128_load(a + i)));
+        sb = wasm_f32x4_add(sb, wasm_f32x4_mul(xi, wasm_v128_load(b + i)));
+    }
+    ra = (wasm_f32x4_extract_lane(sa, 0) + wasm_f32x4_extract_lane(sa, 1)) + (wasm_f32x4_extract_lane(sa, 2) + wasm_f32x4_extract_lane(sa, 3));
+    rb = (wasm_f32x4_extract_lane(sb, 0) + wasm_f32x4_extract_lane(sb, 1)) + (wasm_f32x4_extract_lane(sb, 2) + wasm_f32x4_extract_lane(sb, 3));
+}
+
+void mixFrameWasm(const float * const * tones, int nTones, const float * env, float gain, int16_t * dst, int n) {
+    const v128_t g = wasm_f32x4_splat(gain);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        v128_t s0 = wasm_f32x4_splat(0.0f);
+        v128_t s1 = wasm_f32x4_splat(0.0f);
+        for (int t = 0; t < nTones; ++t) {
+            s0 = wasm_f32x4_add(s0, wasm_v128_load(tones[t] + i));
+            s1 = wasm_f32x4_add(s1, wasm_v128_load(tones[t] + i + 4));
+        }
+        const v128_t r0 = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_nearest(wasm_f32x4_mul(wasm_f32x4_mul(g, wasm_v128_load(env + i)), s0)));
+        const v128_t r1 = wasm_i32x4_trunc_sat_f32x4(wasm_f32x4_nearest(wasm_f32x4_mul(wasm_f32x4_mul(g, wasm_v128_load(env + i + 4)), s1)));
+        wasm_v128_store(dst + i, wasm_i16x8_narrow_i32x4(r0, r1));
+    }
+    mixFrameRange(tones, nTones, env, gain, dst, i, n);
+}
+
+#endif
+
+struct SIMDKernels {
+    const char * name;
+    FFTPass4 fftPass4;
+    Dot2 dot2;
+    MixFrame mixFrame;
+};
+
+// Selected once, based on the instruction sets supported by the running CPU
+const SIMDKernels & getSIMDKernels() {
+    static const SIMDKernels kernels = [] {
+#if defined(SIMD_X86_DISPATCH)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SIMDKernels { "AVX2", fftPass4Avx2, dot2Avx2, mixFrameAvx2 };
+        if (__builtin_cpu_supports("sse3")) return SIMDKernels { "SSE3", fftPass4Sse3, dot2Sse3, mixFrameSse3 };
+#elif defined(__wasm_simd128__)
+        return SIMDKernels { "WASM SIMD", fftPass4Wasm, dot2Wasm, mixFrameWasm };
+#endif
+        return SIMDKernels { "scalar", fftPass4Scalar, dot2Scalar, mixFrameScalar };
+    }();
+
+    return kernels;
+}
+
+// In-place decimation-in-time transform. No allocations
+void transform(std::complex<float>* f, const FFTPlan & plan) {
+    const int N = plan.N;
+    const int * rev = plan.bitReversed.data();
+    const std::complex<float> * W = plan.stageTwiddles.data();
+
+    for (int i = 0; i < N; ++i) {
+        if (i < rev[i]) std::swap(f[i], f[rev[i]]);
+    }
+
     int n = 1;
-    int a = N / 2;
-    for(int j = 0; j < log2(N); j++) {
-        for(int i = 0; i < N; i++) {
-            if(!(i & n)) {
-                std::complex<float> temp = f[i];
-                std::complex<float> Temp = W[(i * a) % (n * a)] * f[i + n];
-                f[i] = temp + Temp;
-                f[i + n] = temp - Temp;
+
+    // odd number of stages - do the first one as a plain radix-2 pass (all twiddles are 1)
+    if (plan.log2N % 2 == 1) {
+        for (int i = 0; i < N; i += 2) {
+            const auto t = f[i + 1];
+            f[i + 1] = f[i] - t;
+            f[i] += t;
+        }
+        n = 2;
+    }
+
+    const FFTPass4 pass4 = getSIMDKernels().fftPass4;
+    for (; n < N; n *= 4) {
+        pass4(f, N, n, W + n - 1, W + 2*n - 1);
+    }
+}
+
+// Real-input transform: the N real samples are packed as N/2 complex values,
+// transformed with an N/2-point FFT and unpacked into the N/2 + 1 non-redundant
+// bins of the N-point spectrum. dst must have room for N/2 + 1 values
+void FFTReal(const float * src, std::complex<float>* dst, int N, float d) {
+    const int M = N/2;
+    for (int i = 0; i < M; ++i) {
+        dst[i] = std::complex<float>(src[2*i], src[2*i + 1]);
+    }
+    transform(dst, getFFTPlan(M));
+
+    const std::complex<float> * W = getFFTPlan(N).twiddles.data();
+    const float h = 0.5f*d;
+
+    // X[k] = (Z[k] + Z*[M-k])/2 - i*W^k*(Z[k] - Z*[M-k])/2, computed for k and M - k at once
+    for (int k = 1; k <= M/2; ++k) {
+        const auto a = dst[k];
+        const auto b = std::conj(dst[M - k]);
+        const auto w = W[k];
+
+        const std::complex<float> e = a + b;
+        const std::complex<float> o = a - b;
+        const std::complex<float> wo = cmul(w, o);
+
+        // -i*wo = (wo.imag, -wo.real)
+        dst[k]     = h*std::complex<float>(e.real() + wo.imag(), e.imag() - wo.real());
+        dst[M - k] = h*std::complex<float>(e.real() - wo.imag(), -e.imag() - wo.real());
+    }
+
+    const auto z0 = dst[0];
+    dst[0] = d*(z0.real() + z0.imag());
+    dst[M] = d*(z0.real() - z0.imag());
+}
+
+// Inverse of FFTReal with d = 1: the N/2 + 1 bins are packed into N/2 complex
+// values, transformed with an N/2-point inverse FFT and unpacked into the N real
+// samples. The bins are overwritten
+void IFFTReal(std::complex<float>* src, float * dst, int N) {
+    const int M = N/2;
+    const std::complex<float> * W = getFFTPlan(N).twiddles.data();
+
+    // Z[k] = E[k] + i*O[k], with E[k] = (X[k] + X*[M-k])/2 and O[k] = W^-k*(X[k] - X*[M-k])/2,
+    // computed for k and M - k at once. Z is conjugated to run the inverse as a forward FFT
+    for (int k = 1; k <= M/2; ++k) {
+        const auto a = src[k];
+        const auto b = std::conj(src[M - k]);
+
+        const std::complex<float> e = 0.5f*(a + b);
+        const std::complex<float> o = cmul(std::conj(W[k]), 0.5f*(a - b));
+
+        // conj(e + i*o) and, for M - k, conj(conj(e) + i*conj(o))
+        src[k]     = std::complex<float>(e.real() - o.imag(), -e.imag() - o.real());
+        src[M - k] = std::complex<float>(e.real() + o.imag(), e.imag() - o.real());
+    }
+
+    {
+        const auto a = src[0];
+        const auto b = std::conj(src[M]);
+        const std::complex<float> e = 0.5f*(a + b);
+        const std::complex<float> o = 0.5f*(a - b);
+        src[0] = std::complex<float>(e.real() - o.imag(), -e.imag() - o.real());
+    }
+
+    transform(src, getFFTPlan(M));
+
+    const float iM = 1.0f/M;
+    for (int m = 0; m < M; ++m) {
+        dst[2*m]     =  src[m].real()*iM;
+        dst[2*m + 1] = -src[m].imag()*iM;
+    }
+}
+
+// Power spectrum of real input in bins [0, N/2]. The mirrored upper half is
+// folded into bins [1, N/2). Returns the total energy over all bins
+double calcPowerSpectrum(const float * src, std::complex<float>* fftOut, float * spectrum, int N) {
+    FFTReal(src, fftOut, N, 1.0);
+
+    double fsum = 0.0;
+    for (int i = 0; i <= N/2; ++i) {
+        spectrum[i] = (fftOut[i].real()*fftOut[i].real() + fftOut[i].imag()*fftOut[i].imag());
+        if (i > 0 && i < N/2) {
+            spectrum[i] *= 2.0f;
+        }
+        fsum += spectrum[i];
+    }
+
+    return fsum;
+}
+
+// Sparse DFT over a fixed set of bins of an N-sample frame. Each bin is a dot
+// product with precomputed cos/sin tables: O(N) per bin, with no dependency
+// between samples, so it vectorizes well. Cheaper than a full FFT when only a
+// few bins are needed
+struct SparseDFTBank {
+    void init(int aN, const std::vector<int> & aBins) {
+        if (aN == N && aBins == bins) return;
+
+        N = aN;
+        bins = aBins;
+
+        cosTable.resize(bins.size()*N);
+        sinTable.resize(bins.size()*N);
+        for (int b = 0; b < (int) bins.size(); ++b) {
+            for (int n = 0; n < N; ++n) {
+                const double phase = (2.0*M_PI*((bins[b]*n) % N))/N;
+                cosTable[b*N + n] = std::cos(phase);
+                sinTable[b*N + n] = -std::sin(phase);
             }
         }
-        n *= 2;
-        a = a / 2;
     }
-    free(W);
+
+    // Bin b of the DFT of src, same scaling as FFTReal. N must be a multiple of 8
+    std::complex<float> eval(const float * src, int b) const {
+        return evalRange(src, b, 0, N);
+    }
+
+    // Contribution of the samples [i0, i0 + n) of a frame to bin b, with src pointing
+    // at sample i0. The contributions of consecutive ranges add up to eval(). n must
+    // be a multiple of 8
+    std::complex<float> evalRange(const float * src, int b, int i0, int n) const {
+        float re, im;
+        getSIMDKernels().dot2(src, cosTable.data() + b*N + i0, sinTable.data() + b*N + i0, n, re, im);
+        return std::complex<float>(re, im);
+    }
+
+    // Power of the value x of bin b, folded the same way as calcPowerSpectrum
+    float power(const std::complex<float> & x, int b) const {
+        const float p = x.real()*x.real() + x.imag()*x.imag();
+        return (bins[b] > 0 && bins[b] < N/2) ? 2.0f*p : p;
+    }
+
+    int N = 0;
+    std::vector<int> bins;
+    std::vector<float> cosTable; // bins.size() x N
+    std::vector<float> sinTable; // bins.size() x N
+};
+
+// Fixed set of threads that run a job together. The calling thread takes part as
+// worker 0. The web build has no threads and runs the job on the caller only
+class WorkerPool {
+public:
+    explicit WorkerPool(int nWorkers) : nWorkers(std::max(1, nWorkers)) {
+#ifndef __EMSCRIPTEN__
+        for (int w = 1; w < this->nWorkers; ++w) {
+            threads.emplace_back([this, w]() { loop(w); });
+        }
+#else
+        this->nWorkers = 1;
+#endif
+    }
+
+    ~WorkerPool() {
+#ifndef __EMSCRIPTEN__
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        cvStart.notify_all();
+        for (auto & t : threads) t.join();
+#endif
+    }
+
+    int size() const { return nWorkers; }
+
+    // Calls job(workerId) once on every worker and returns when all calls are done
+    void run(const std::function<void(int)> & job) {
+#ifndef __EMSCRIPTEN__
+        if (nWorkers > 1) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                curJob = &job;
+                nBusy = nWorkers - 1;
+                ++jobId;
+            }
+            cvStart.notify_all();
+
+            job(0);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            cvDone.wait(lock, [this]() { return nBusy == 0; });
+            curJob = nullptr;
+            return;
+        }
+#endif
+        job(0);
+    }
+
+private:
+#ifndef __EMSCRIPTEN__
+    void loop(int workerId) {
+        int lastJobId = 0;
+        while (true) {
+            const std::function<void(int)> * job = nullptr;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cvStart.wait(lock, [&]() { return stop || jobId != lastJobId; });
+                if (stop) return;
+                lastJobId = jobId;
+                job = curJob;
+            }
+
+            (*job)(workerId);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--nBusy == 0) cvDone.notify_one();
+            }
+        }
+    }
+
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable cvStart;
+    std::condition_variable cvDone;
+    const std::function<void(int)> * curJob = nullptr;
+    int jobId = 0;
+    int nBusy = 0;
+    bool stop = false;
+#endif
+
+    int nWorkers;
+};
+
+WorkerPool & getWorkerPool() {
+#ifndef __EMSCRIPTEN__
+    static WorkerPool pool(std::thread::hardware_concurrency());
+#else
+    static WorkerPool pool(1);
+#endif
+    return pool;
+}
+
+// Process-wide pool of RS codecs, keyed by (msg_length, ecc_length). A codec keeps
+// its decoding state in itself, so it is used by one thread at a time: it is taken
+// from the pool and goes back to it when its RSCodec handle is released. The
+// codecs are created with the generator already cached and are never freed
+class RSCodecPool {
+public:
+    struct Release {
+        void operator()(RS::ReedSolomon * rs) const;
+    };
+
+    using Codec = std::unique_ptr<RS::ReedSolomon, Release>;
+
+    Codec acquire(int msgLength, int eccLength) {
+        ++nAcquired;
+        {
+#ifndef __EMSCRIPTEN__
+            std::lock_guard<std::mutex> lock(mutex);
+#endif
+            auto & codecs = freeCodecs[std::make_pair(msgLength, eccLength)];
+            if (codecs.empty() == false) {
+                RS::ReedSolomon * rs = codecs.back();
+                codecs.pop_back();
+                return Codec(rs);
+            }
+        }
+
+        ++nAllocated;
+        RS::ReedSolomon * rs = create(msgLength, eccLength);
+
+        // the generator is computed and cached by the first encode
+        std::array<uint8_t, ::kMaxDataSize> zeros;
+        zeros.fill(0);
+        rs->EncodeBlock(zeros.data(), zeros.data() + msgLength);
+
+        return Codec(rs);
+    }
+
+    int allocated() const { return nAllocated; }
+    int acquired() const { return nAcquired; }
+
+private:
+    // The FixedLength data and the VariableLength header have codecs specialized
+    // for their lengths
+    static RS::ReedSolomon * create(int msgLength, int eccLength) {
+        if (msgLength == ::kDefaultFixedLength && eccLength == ::kDefaultFixedECCLength) {
+            return new RS::ReedSolomonFixed<::kDefaultFixedLength, ::kDefaultFixedECCLength>();
+        }
+        if (msgLength == 1 && eccLength == 2) {
+            return new RS::ReedSolomonFixed<1, 2>();
+        }
+
+        return new RS::ReedSolomon(msgLength, eccLength);
+    }
+
+    void release(RS::ReedSolomon * rs) {
+#ifndef __EMSCRIPTEN__
+        std::lock_guard<std::mutex> lock(mutex);
+#endif
+        freeCodecs[std::make_pair((int) rs->msg_length, (int) rs->ecc_length)].push_back(rs);
+    }
+
+#ifndef __EMSCRIPTEN__
+    std::mutex mutex;
+#endif
+    std::map<std::pair<int, int>, std::vector<RS::ReedSolomon *>> freeCodecs;
+
+    std::atomic<int> nAllocated{0};
+    std::atomic<int> nAcquired{0};
+};
+
+using RSCodec = RSCodecPool::Codec;
+
+RSCodecPool & getRSCodecPool() {
+    static RSCodecPool pool;
+    return pool;
 }
 
-void FFT(std::complex<float>* f, int N, float d) {
-    transform(f, N);
-    for(int i = 0; i < N; i++)
-        f[i] *= d; //multiplying by step
+void RSCodecPool::Release::operator()(RS::ReedSolomon * rs) const {
+    getRSCodecPool().release(rs);
 }
 
-void FFT(float * src, std::complex<float>* dst, int N, float d) {
-    for (int i = 0; i < N; ++i) {
-        dst[i].real(src[i]);
-        dst[i].imag(0);
+#ifndef __EMSCRIPTEN__
+// Blocking queue of limited capacity, connecting the stages of the native runtime
+template <class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(int capacity) : capacity(capacity) {}
+
+    // Waits while the queue is full
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cvPop.wait(lock, [this]() { return (int) items.size() < capacity; });
+        items.push_back(std::move(item));
+        cvPush.notify_one();
+    }
+
+    // Waits while the queue is empty
+    T pop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cvPush.wait(lock, [this]() { return items.empty() == false; });
+        T item = std::move(items.front());
+        items.pop_front();
+        cvPop.notify_one();
+        return item;
+    }
+
+private:
+    const int capacity;
+
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable cvPush;
+    std::condition_variable cvPop;
+};
+#endif
+
+// Lock-free single-producer/single-consumer ring of captured samples. The audio
+// callback pushes the samples and the Rx side reads them in place, one frame at a
+// time. The start of the buffer is mirrored past its end, so every view of up to
+// kMaxSamplesPerFrame samples is contiguous. The views stay valid until the Rx side
+// releases them. When the ring is full, the pushed samples are dropped and counted
+// as an overrun
+class CaptureRing {
+public:
+    // The capacity must be a power of 2
+    explicit CaptureRing(int capacity) : capacity(capacity), mask(capacity - 1), buffer(capacity + ::kMaxSamplesPerFrame) {}
+
+    // Producer side
+    bool push(const float * src, int n) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        const size_t t = tail.load(std::memory_order_acquire);
+        if (h - t + n > (size_t) capacity) {
+            ++nOverruns;
+            return false;
+        }
+
+        const int i0 = h & mask;
+        const int n0 = std::min(n, capacity - i0);
+        write(src, i0, n0);
+        write(src + n0, 0, n - n0);
+
+        head.store(h + n, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns a view of the next n samples and moves past them, or
+    // nullptr if fewer are available
+    const float * read(int n) {
+        const size_t h = head.load(std::memory_order_acquire);
+        if (h - readPos < (size_t) n) {
+            return nullptr;
+        }
+
+        const float * res = buffer.data() + (readPos & mask);
+        readPos += n;
+        return res;
+    }
+
+    // Consumer side. Gives the samples before the last nKeep read ones back to the
+    // producer
+    void release(int nKeep) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (readPos - t > (size_t) nKeep) {
+            tail.store(readPos - nKeep, std::memory_order_release);
+        }
     }
-    FFT(dst, N, d);
+
+    // Consumer side. Drops all available samples and releases all views
+    void clear() {
+        readPos = head.load(std::memory_order_acquire);
+        tail.store(readPos, std::memory_order_release);
+    }
+
+    // Consumer side. Number of samples not read yet
+    int size() const {
+        return head.load(std::memory_order_acquire) - readPos;
+    }
+
+    int overruns() const { return nOverruns; }
+
+private:
+    void write(const float * src, int i0, int n) {
+        std::copy(src, src + n, buffer.data() + i0);
+        if (i0 < ::kMaxSamplesPerFrame) {
+            const int nMirror = std::min(n, ::kMaxSamplesPerFrame - i0);
+            std::copy(src, src + nMirror, buffer.data() + capacity + i0);
+        }
+    }
+
+    const int capacity;
+    const size_t mask;
+    std::vector<float> buffer;
+
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+    std::atomic<int> nOverruns{0};
+
+    size_t readPos = 0;
+};
+
+CaptureRing & getCaptureRing() {
+    static CaptureRing ring(::kCaptureRingSize);
+    return ring;
+}
+
+// Lock-free single-producer/single-consumer ring of samples to play. The Tx side
+// pushes whole frames while there is room and the audio callback pops them
+class PlaybackRing {
+public:
+    // The capacity must be a power of 2
+    explicit PlaybackRing(int capacity) : capacity(capacity), mask(capacity - 1), buffer(capacity) {}
+
+    // Producer side. Number of samples that can be pushed
+    int space() const {
+        return capacity - (head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire));
+    }
+
+    // Producer side. Pushes all n samples, or nothing if there is no room for them
+    bool push(const int16_t * src, int n) {
+        if (space() < n) {
+            return false;
+        }
+
+        const size_t h = head.load(std::memory_order_relaxed);
+        const int i0 = h & mask;
+        const int n0 = std::min(n, capacity - i0);
+        std::copy(src, src + n0, buffer.data() + i0);
+        std::copy(src + n0, src + n, buffer.data());
+
+        head.store(h + n, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Pops up to n samples and returns their number
+    int pop(int16_t * dst, int n) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        const size_t h = head.load(std::memory_order_acquire);
+        n = std::min(n, (int) (h - t));
+
+        const int i0 = t & mask;
+        const int n0 = std::min(n, capacity - i0);
+        std::copy(buffer.data() + i0, buffer.data() + i0 + n0, dst);
+        std::copy(buffer.data(), buffer.data() + n - n0, dst + n0);
+
+        tail.store(t + n, std::memory_order_release);
+        return n;
+    }
+
+    // Number of samples waiting to be played
+    int size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+private:
+    const int capacity;
+    const size_t mask;
+    std::vector<int16_t> buffer;
+
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+};
+
+PlaybackRing & getPlaybackRing() {
+    static PlaybackRing ring(::kPlaybackRingSize);
+    return ring;
+}
+
+using Waveform = std::shared_ptr<const std::vector<int16_t>>;
+
+// LRU cache of the rendered transmissions, keyed by the protocol parameters and
+// the payload, so that a repeated send is a copy of the samples. It is used only
+// by the thread that sends; the counters can be read from any thread
+class WaveformCache {
+public:
+    explicit WaveformCache(size_t capacity_bytes) : capacity_bytes(capacity_bytes) {}
+
+    Waveform find(const std::string & key) {
+        auto it = index.find(key);
+        if (it == index.end()) {
+            ++nMisses;
+            return nullptr;
+        }
+
+        ++nHits;
+        entries.splice(entries.begin(), entries, it->second);
+        return it->second->second;
+    }
+
+    void insert(const std::string & key, Waveform waveform) {
+        const size_t size_bytes = waveform->size()*sizeof(int16_t);
+        if (size_bytes > capacity_bytes || index.count(key)) {
+            return;
+        }
+
+        while (used_bytes + size_bytes > capacity_bytes) {
+            used_bytes -= entries.back().second->size()*sizeof(int16_t);
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+
+        entries.emplace_front(key, std::move(waveform));
+        index[key] = entries.begin();
+        used_bytes += size_bytes;
+    }
+
+    int hits() const { return nHits; }
+    int misses() const { return nMisses; }
+
+private:
+    using Entry = std::pair<std::string, Waveform>;
+
+    const size_t capacity_bytes;
+    size_t used_bytes = 0;
+
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+    std::atomic<int> nHits{0};
+    std::atomic<int> nMisses{0};
+};
+
+WaveformCache & getWaveformCache() {
+    static WaveformCache cache(::kWaveformCacheSize_bytes);
+    return cache;
 }
 
 enum TxMode {
@@ -135,25 +1076,25 @@ enum TxMode {
 };
 
 using AmplitudeData   = std::array<float, kMaxSamplesPerFrame>;
-using AmplitudeData16 = std::array<int16_t, kMaxRecordedFrames*kMaxSamplesPerFrame>;
 using SpectrumData    = std::array<float, kMaxSamplesPerFrame>;
-using RecordedData    = std::array<float, kMaxRecordedFrames*kMaxSamplesPerFrame>;
 
-inline void addAmplitudeSmooth(const AmplitudeData & src, AmplitudeData & dst, float scalar, int startId, int finalId, int cycleMod, int nPerCycle) {
-    int nTotal = nPerCycle*finalId;
+// Envelope of frame cycleMod of a tone that lasts nPerCycle frames of n samples.
+// It ramps up over the first 15% of the tone and down over the last 15%
+void getToneEnvelope(float * env, int n, int cycleMod, int nPerCycle) {
+    int nTotal = nPerCycle*n;
     float frac = 0.15f;
     float ds = frac*nTotal;
     float ids = 1.0f/ds;
     int nBegin = frac*nTotal;
     int nEnd = (1.0f - frac)*nTotal;
-    for (int i = startId; i < finalId; i++) {
-        float k = cycleMod*finalId + i;
+    for (int i = 0; i < n; i++) {
+        float k = cycleMod*n + i;
         if (k < nBegin) {
-            dst[i] += scalar*src[i]*(k*ids);
+            env[i] = k*ids;
         } else if (k > nEnd) {
-            dst[i] += scalar*src[i]*(((float)(nTotal) - k)*ids);
+            env[i] = ((float)(nTotal) - k)*ids;
         } else {
-            dst[i] += scalar*src[i];
+            env[i] = 1.0f;
         }
     }
 }
@@ -166,6 +1107,41 @@ float getTime_ms(const T & tStart, const T & tEnd) {
 int getECCBytesForLength(int len) {
     return std::max(4, 2*(len/5));
 }
+
+// RS codewords of a VariableLength payload. Up to kMaxLength bytes are one
+// codeword. Longer payloads are split into equal, zero padded codewords of at
+// most kMaxLength bytes, whose bytes are interleaved in the symbol stream: byte k
+// of codeword i is sent at k*nBlocks + i, so that a burst of errors is spread
+// over all the codewords
+struct BlockLayout {
+    int nBlocks;
+    int msgLength;
+    int eccLength;
+};
+
+BlockLayout getBlockLayout(int len) {
+    BlockLayout res;
+    res.nBlocks = std::max(1, (len + kMaxLength - 1)/kMaxLength);
+    res.msgLength = (len + res.nBlocks - 1)/res.nBlocks;
+    res.eccLength = getECCBytesForLength(res.msgLength);
+    return res;
+}
+
+// The length header is one RS(1, 2) codeword holding the length. A long payload
+// has two RS(1, 2) codewords instead, holding the digits of its length in base
+// kLongLengthBase, both sent above kMaxLength. So the second codeword is never
+// taken for the header of a short payload at an offset one codeword late
+constexpr auto kLongLengthBase = 255 - kMaxLength;
+
+int getHeaderLength(int len) {
+    return (len > kMaxLength) ? kMaxHeaderLength : 3;
+}
+
+// Number of encoded VariableLength bytes, including the length header
+int getEncodedLengthForLength(int len) {
+    const auto layout = getBlockLayout(len);
+    return getHeaderLength(len) + layout.nBlocks*(layout.msgLength + layout.eccLength);
+}
 }
 
 struct DataRxTx {
@@ -179,9 +1155,10 @@ struct DataRxTx {
     }
 
     void init(int textLength, const char * stext) {
-        if (textLength > ::kMaxLength) {
-            printf("Truncating data from %d to 140 bytes\n", textLength);
-            textLength = ::kMaxLength;
+        const int maxLength = (txMode == ::TxMode::FixedLength) ? ::kMaxLength : ::kMaxLongLength;
+        if (textLength > maxLength) {
+            printf("Truncating data from %d to %d bytes\n", textLength, maxLength);
+            textLength = maxLength;
         }
 
         const uint8_t * text = reinterpret_cast<const uint8_t *>(stext);
@@ -195,8 +1172,10 @@ struct DataRxTx {
         ihzPerFrame = 1.0/hzPerFrame;
         framesPerTx = paramFramesPerTx;
 
+        const auto layout = ::getBlockLayout(textLength);
+
         nDataBitsPerTx = paramBytesPerTx*8;
-        nECCBytesPerTx = (txMode == ::TxMode::FixedLength) ? paramECCBytesPerTx : getECCBytesForLength(textLength);
+        nECCBytesPerTx = (txMode == ::TxMode::FixedLength) ? paramECCBytesPerTx : layout.nBlocks*layout.eccLength;
 
         framesToAnalyze = 0;
         framesLeftToAnalyze = 0;
@@ -205,7 +1184,7 @@ struct DataRxTx {
         nBitsInMarker = 16;
         nMarkerFrames = 16;
         nPostMarkerFrames = 0;
-        sendDataLength = (txMode == ::TxMode::FixedLength) ? ::kDefaultFixedLength : textLength + 3;
+        sendDataLength = (txMode == ::TxMode::FixedLength) ? ::kDefaultFixedLength : ::getHeaderLength(textLength) + layout.nBlocks*layout.msgLength;
 
         d0 = paramFreqDelta/2;
         freqDelta_hz = hzPerFrame*paramFreqDelta;
@@ -215,7 +1194,8 @@ struct DataRxTx {
             freqDelta_hz *= 2;
         }
 
-        outputBlock.fill(0);
+        txEnvelopeCycleMod = -1;
+        txEnvelopeNPerCycle = -1;
         encodedData.fill(0);
 
         for (int k = 0; k < (int) phaseOffsets.size(); ++k) {
@@ -226,44 +1206,113 @@ struct DataRxTx {
 #endif
 
         for (int k = 0; k < (int) dataBits.size(); ++k) {
-            double freq = freqStart_hz + freqDelta_hz*k;
-            dataFreqs_hz[k] = freq;
-
-            double phaseOffset = phaseOffsets[k];
-            double curHzPerFrame = sampleRateOut/samplesPerFrame;
-            double curIHzPerFrame = 1.0/curHzPerFrame;
-            for (int i = 0; i < samplesPerFrame; i++) {
-                double curi = i;
-                bit1Amplitude[k][i] = std::sin((2.0*M_PI)*(curi*isamplesPerFrame)*(freq*curIHzPerFrame) + phaseOffset);
-            }
-            for (int i = 0; i < samplesPerFrame; i++) {
-                double curi = i;
-                bit0Amplitude[k][i] = std::sin((2.0*M_PI)*(curi*isamplesPerFrame)*((freq + hzPerFrame*d0)*curIHzPerFrame) + phaseOffset);
+            dataFreqs_hz[k] = freqStart_hz + freqDelta_hz*k;
+        }
+
+        // a transmission that was rendered before is replayed from the cache
+        txWaveform = nullptr;
+        txWaveformPos = 0;
+        txRecording.clear();
+        txKey.clear();
+        if (textLength > 0) {
+            txKey = getWaveformKey(textLength, text);
+            txWaveform = ::getWaveformCache().find(txKey);
+        }
+
+        // the tone tables are needed only for sending, and are sized for the tones
+        // of this transmission. The IFFT synthesis needs no tables
+        txIFFT = isTxIFFT();
+        if (textLength > 0 && txIFFT == false && txWaveform == nullptr) {
+            const int nTones = getTxTones();
+            bit1Amplitude.resize(nTones);
+            bit0Amplitude.resize(nTones);
+            bit1Frame.assign(nTones, -1);
+            bit0Frame.assign(nTones, -1);
+
+            for (int k = 0; k < nTones; ++k) {
+                synthesizeTone(k, true, 0, samplesPerFrame, bit1Amplitude[k].data());
+                synthesizeTone(k, false, 0, samplesPerFrame, bit0Amplitude[k].data());
             }
         }
 
-        if (rsData) delete rsData;
-        if (rsLength) delete rsLength;
+        {
+            std::vector<int> markerBins;
+            for (int i = 0; i < nBitsInMarker; ++i) {
+                int bin = std::round(dataFreqs_hz[i]*ihzPerFrame);
+                markerBins.push_back(bin);
+                markerBins.push_back(bin + d0);
+            }
+            markerBank.init(samplesPerFrame, markerBins);
 
-        if (txMode == ::TxMode::FixedLength) {
-            rsData = new RS::ReedSolomon(kDefaultFixedLength, nECCBytesPerTx);
-        } else {
-            rsData = new RS::ReedSolomon(textLength, nECCBytesPerTx);
-            rsLength = new RS::ReedSolomon(1, 2);
+            markerBinHistory.assign(::kMaxSpectrumHistory*markerBins.size(), 0.0f);
+            markerBinValid.assign(::kMaxSpectrumHistory*markerBins.size(), false);
         }
 
-        if (textLength > 0) {
-            static std::array<char, ::kMaxDataSize> theData;
+        {
+            std::vector<int> dataBins;
+            if (paramFreqDelta > 1) {
+                for (int i = 0; i < nDataBitsPerTx; ++i) {
+                    int bin = std::round(dataFreqs_hz[i]*ihzPerFrame);
+                    dataBins.push_back(bin);
+                    dataBins.push_back(bin + d0);
+                }
+            } else {
+                int bin = std::round(dataFreqs_hz[0]*ihzPerFrame);
+                for (int i = 0; i < 2*(nDataBitsPerTx/8)*16; ++i) {
+                    dataBins.push_back(bin + i);
+                }
+            }
+            dataBank.init(samplesPerFrame, dataBins);
+
+            // data bins of the start marker bits: the tone that is on during the
+            // marker, followed by the one that is off
+            markerDataBins.clear();
+            for (int i = 0; i < nBitsInMarker; ++i) {
+                int bin = std::round(dataFreqs_hz[i]*ihzPerFrame);
+                auto it0 = std::find(dataBins.begin(), dataBins.end(), (i%2 == 0) ? bin : bin + d0);
+                auto it1 = std::find(dataBins.begin(), dataBins.end(), (i%2 == 0) ? bin + d0 : bin);
+                if (it0 != dataBins.end() && it1 != dataBins.end()) {
+                    markerDataBins.push_back(it0 - dataBins.begin());
+                    markerDataBins.push_back(it1 - dataBins.begin());
+                }
+            }
+            stepSpectra.resize(getStepRows()*dataBins.size());
+        }
+
+        if (textLength > 0 && txWaveform) {
+            hasData = true;
+        } else if (textLength > 0) {
+            auto & codecPool = ::getRSCodecPool();
+            auto rsData = (txMode == ::TxMode::FixedLength) ?
+                codecPool.acquire(::kDefaultFixedLength, nECCBytesPerTx) :
+                codecPool.acquire(layout.msgLength, layout.eccLength);
+
+            static std::array<char, ::kMaxEncodedSize> theData;
             theData.fill(0);
 
             if (txMode == ::TxMode::FixedLength) {
                 for (int i = 0; i < textLength; ++i) theData[i] = text[i];
                 rsData->Encode(theData.data(), encodedData.data());
             } else {
-                theData[0] = textLength;
-                for (int i = 0; i < textLength; ++i) theData[i + 1] = text[i];
-                rsData->Encode(theData.data() + 1, encodedData.data() + 3);
-                rsLength->Encode(theData.data(), encodedData.data());
+                auto rsLength = codecPool.acquire(1, 2);
+                uint8_t header[2] = { (uint8_t) textLength, 0 };
+                if (textLength > ::kMaxLength) {
+                    header[0] = ::kMaxLength + 1 + textLength/::kLongLengthBase;
+                    header[1] = ::kMaxLength + 1 + textLength % ::kLongLengthBase;
+                    rsLength->Encode(header + 1, encodedData.data() + 3);
+                }
+                rsLength->Encode(header, encodedData.data());
+
+                const int headerLength = ::getHeaderLength(textLength);
+                const int nEncoded = layout.msgLength + layout.eccLength;
+                for (int i = 0; i < textLength; ++i) theData[i] = text[i];
+                for (int b = 0; b < layout.nBlocks; ++b) {
+                    std::array<uint8_t, ::kMaxDataSize> codeword;
+                    rsData->Encode(theData.data() + b*layout.msgLength, codeword.data());
+                    for (int k = 0; k < nEncoded; ++k) {
+                        encodedData[headerLength + k*layout.nBlocks + b] = codeword[k];
+                    }
+                }
             }
 
             hasData = true;
@@ -273,58 +1322,152 @@ struct DataRxTx {
         receivingData = false;
         analyzingData = false;
 
-        sampleAmplitude.fill(0);
-
         sampleSpectrum.fill(0);
-        for (auto & s : sampleAmplitudeHistory) {
-            s.fill(0);
-        }
+        sampleAmplitudeSilence.fill(0);
+        sampleAmplitudeHistory.fill(sampleAmplitudeSilence.data());
 
         rxData.fill(0);
 
-        for (int i = 0; i < samplesPerFrame; ++i) {
+        for (int i = 0; i <= samplesPerFrame/2; ++i) {
             fftOut[i].real(0.0f);
             fftOut[i].imag(0.0f);
         }
     }
 
-    void send() {
-        int samplesPerFrameOut = (sampleRateOut/sampleRate)*samplesPerFrame;
+    // Everything the rendered samples depend on
+    std::string getWaveformKey(int textLength, const uint8_t * text) const {
+        const int params[] = {
+            (int) sampleRate, (int) sampleRateOut, samplesPerFrame, (int) txMode, paramFreqDelta,
+            paramFreqStart, paramFramesPerTx, paramBytesPerTx, paramECCBytesPerTx, paramVolume,
+        };
+
+        std::string res(reinterpret_cast<const char *>(params), sizeof(params));
+        res.append(reinterpret_cast<const char *>(text), textLength);
+        return res;
+    }
+
+    // Number of tones used by the marker and the data
+    int getTxTones() const {
+        return std::max(nBitsInMarker, (paramFreqDelta > 1) ? nDataBitsPerTx : 2*nDataBitsPerTx);
+    }
+
+    int getSamplesPerFrameOut() const {
+        return (sampleRateOut/sampleRate)*samplesPerFrame;
+    }
+
+    // Memory of the instance and of the storage sized for the current protocol
+    size_t getMemoryFootprint_bytes() const {
+        size_t res = sizeof(*this);
+        res += (bit1Amplitude.capacity() + bit0Amplitude.capacity())*sizeof(::AmplitudeData);
+        res += (markerBank.cosTable.capacity() + markerBank.sinTable.capacity())*sizeof(float);
+        res += (dataBank.cosTable.capacity() + dataBank.sinTable.capacity())*sizeof(float);
+        res += (markerBinHistory.capacity() + stepSpectra.capacity())*sizeof(std::complex<float>);
+        for (const auto * candidates : { &rxCandidates, &analysisCandidates }) {
+            for (const auto & candidate : *candidates) {
+                res += candidate.encodedData.capacity() + candidate.encodedAlt.capacity() + candidate.confidence.capacity()*sizeof(float);
+            }
+        }
+        res += markerBinValid.capacity()/8;
+        res += batchEncoded.capacity() + batchDecoded.capacity();
+        res += rxWorkers.capacity()*sizeof(RxWorker);
+        return res;
+    }
+
+    // Writes n samples of tone k for the given bit, starting at output sample i0.
+    // The phase advances by a complex rotation per sample, so a run of samples
+    // takes two trigonometric calls
+    void synthesizeTone(int k, bool bit, int i0, int n, float * dst) const {
+        const double freq = dataFreqs_hz[k] + (bit ? 0.0 : hzPerFrame*d0);
+        const double w = (2.0*M_PI)*freq/sampleRateOut;
+
+        std::complex<double> z = std::polar(1.0, w*i0 + phaseOffsets[k]);
+        const std::complex<double> r = std::polar(1.0, w);
+        for (int i = 0; i < n; ++i) {
+            dst[i] = z.imag();
+            z *= r;
+        }
+    }
+
+    // Tone k for the given bit in the current frame. Without resampling every frame
+    // starts at the same phase and the tables from init() are used as they are.
+    // Otherwise the tones are synthesized on their first use in each frame,
+    // continuing the phase of the output
+    const ::AmplitudeData & getTone(int k, bool bit) {
+        auto & tone = bit ? bit1Amplitude[k] : bit0Amplitude[k];
         if (sampleRateOut != sampleRate) {
-            printf("Resampling from %d Hz to %d Hz\n", (int) sampleRate, (int) sampleRateOut);
+            auto & toneFrame = bit ? bit1Frame[k] : bit0Frame[k];
+            if (toneFrame != frameId) {
+                const int samplesPerFrameOut = getSamplesPerFrameOut();
+                synthesizeTone(k, bit, frameId*samplesPerFrameOut, samplesPerFrameOut, tone.data());
+                toneFrame = frameId;
+            }
         }
 
-        while(hasData) {
-            int nBytesPerTx = nDataBitsPerTx/8;
-            std::fill(outputBlock.begin(), outputBlock.end(), 0.0f);
-            std::uint16_t nFreq = 0;
+        return tone;
+    }
 
-            if (sampleRateOut != sampleRate) {
-                for (int k = 0; k < nDataBitsPerTx; ++k) {
-                    double freq = freqStart_hz + freqDelta_hz*k;
+    // Without resampling all tones sit on the bins of the output frame, and a
+    // frame can be synthesized with one inverse FFT of its tones instead of
+    // summing a table per tone
+    bool isTxIFFT() const {
+        return sampleRateOut == sampleRate && (samplesPerFrame & (samplesPerFrame - 1)) == 0;
+    }
 
-                    double phaseOffset = phaseOffsets[k];
-                    double curHzPerFrame = sampleRateOut/samplesPerFrame;
-                    double curIHzPerFrame = 1.0/curHzPerFrame;
-                    for (int i = 0; i < samplesPerFrameOut; i++) {
-                        double curi = (i + frameId*samplesPerFrameOut);
-                        bit1Amplitude[k][i] = std::sin((2.0*M_PI)*(curi*isamplesPerFrame)*(freq*curIHzPerFrame) + phaseOffset);
-                    }
-                    for (int i = 0; i < samplesPerFrameOut; i++) {
-                        double curi = (i + frameId*samplesPerFrameOut);
-                        bit0Amplitude[k][i] = std::sin((2.0*M_PI)*(curi*isamplesPerFrame)*((freq + hzPerFrame*d0)*curIHzPerFrame) + phaseOffset);
-                    }
-                }
+    // Adds tone k for the given bit to the current frame, with the envelope of
+    // frame cycleMod of nPerCycle. All tones of a frame share the envelope, which
+    // is applied when the frame is mixed
+    void addTone(int k, bool bit, int cycleMod, int nPerCycle) {
+        txCycleMod = cycleMod;
+        txNPerCycle = nPerCycle;
+
+        if (txIFFT) {
+            // A*sin(2*pi*b*n/N + phi) is the bin b = -i*A*N/2*exp(i*phi) of a real signal
+            const int bin = std::round(dataFreqs_hz[k]*ihzPerFrame) + (bit ? 0 : d0);
+            txSpectrum[bin] += std::polar(0.5f*sendVolume*samplesPerFrame, (float) (phaseOffsets[k] - 0.5*M_PI));
+            return;
+        }
+
+        txTones[nTxTones++] = getTone(k, bit).data();
+    }
+
+    // Generates the next frames of the transmission into the playback ring, as
+    // long as it has room for them. Called until hasData is false, so the audio
+    // starts with the first frame and the memory does not grow with the length
+    void send() {
+        int samplesPerFrameOut = getSamplesPerFrameOut();
+        auto & playbackRing = ::getPlaybackRing();
+        if (txWaveform) {
+            const int n = txWaveform->size();
+            while (txWaveformPos < n && playbackRing.space() >= samplesPerFrameOut) {
+                playbackRing.push(txWaveform->data() + txWaveformPos, samplesPerFrameOut);
+                txWaveformPos += samplesPerFrameOut;
+            }
+            if (txWaveformPos >= n) {
+                txWaveform = nullptr;
+                hasData = false;
             }
+            return;
+        }
+
+        if (sampleRateOut != sampleRate && frameId == 0) {
+            printf("Resampling from %d Hz to %d Hz\n", (int) sampleRate, (int) sampleRateOut);
+        }
+
+        while (hasData && playbackRing.space() >= samplesPerFrameOut) {
+            int nBytesPerTx = nDataBitsPerTx/8;
+            std::fill(txSpectrum.begin(), txSpectrum.end(), 0.0f);
+            txNPerCycle = 0;
+            nTxTones = 0;
+            std::uint16_t nFreq = 0;
 
             if (frameId < nMarkerFrames) {
                 nFreq = nBitsInMarker;
 
                 for (int i = 0; i < nBitsInMarker; ++i) {
                     if (i%2 == 0) {
-                        ::addAmplitudeSmooth(bit1Amplitude[i], outputBlock, sendVolume, 0, samplesPerFrameOut, frameId, nMarkerFrames);
+                        addTone(i, true, frameId, nMarkerFrames);
                     } else {
-                        ::addAmplitudeSmooth(bit0Amplitude[i], outputBlock, sendVolume, 0, samplesPerFrameOut, frameId, nMarkerFrames);
+                        addTone(i, false, frameId, nMarkerFrames);
                     }
                 }
             } else if (frameId < nMarkerFrames + nPostMarkerFrames) {
@@ -332,9 +1475,9 @@ struct DataRxTx {
 
                 for (int i = 0; i < nBitsInMarker; ++i) {
                     if (i%2 == 0) {
-                        ::addAmplitudeSmooth(bit0Amplitude[i], outputBlock, sendVolume, 0, samplesPerFrameOut, frameId - nMarkerFrames, nPostMarkerFrames);
+                        addTone(i, false, frameId - nMarkerFrames, nPostMarkerFrames);
                     } else {
-                        ::addAmplitudeSmooth(bit1Amplitude[i], outputBlock, sendVolume, 0, samplesPerFrameOut, frameId - nMarkerFrames, nPostMarkerFrames);
+                        addTone(i, true, frameId - nMarkerFrames, nPostMarkerFrames);
                     }
                 }
             } else if (frameId <
@@ -357,10 +1500,10 @@ struct DataRxTx {
                     for (int k = 0; k < nDataBitsPerTx; ++k) {
                         ++nFreq;
                         if (dataBits[k] == false) {
-                            ::addAmplitudeSmooth(bit0Amplitude[k], outputBlock, sendVolume, 0, samplesPerFrameOut, cycleModMain, framesPerTx);
+                            addTone(k, false, cycleModMain, framesPerTx);
                             continue;
                         }
-                        ::addAmplitudeSmooth(bit1Amplitude[k], outputBlock, sendVolume, 0, samplesPerFrameOut, cycleModMain, framesPerTx);
+                        addTone(k, true, cycleModMain, framesPerTx);
                     }
                 } else {
                     for (int j = 0; j < nBytesPerTx; ++j) {
@@ -379,9 +1522,9 @@ struct DataRxTx {
 
                         ++nFreq;
                         if (k%2) {
-                            ::addAmplitudeSmooth(bit0Amplitude[k/2], outputBlock, sendVolume, 0, samplesPerFrameOut, cycleModMain, framesPerTx);
+                            addTone(k/2, false, cycleModMain, framesPerTx);
                         } else {
-                            ::addAmplitudeSmooth(bit1Amplitude[k/2], outputBlock, sendVolume, 0, samplesPerFrameOut, cycleModMain, framesPerTx);
+                            addTone(k/2, true, cycleModMain, framesPerTx);
                         }
                     }
                 }
@@ -394,9 +1537,9 @@ struct DataRxTx {
                 int fId = frameId - ((nMarkerFrames + nPostMarkerFrames) + ((sendDataLength + nECCBytesPerTx)/nBytesPerTx + 2)*framesPerTx);
                 for (int i = 0; i < nBitsInMarker; ++i) {
                     if (i%2 == 0) {
-                        ::addAmplitudeSmooth(bit0Amplitude[i], outputBlock, sendVolume, 0, samplesPerFrameOut, fId, nMarkerFrames);
+                        addTone(i, false, fId, nMarkerFrames);
                     } else {
-                        ::addAmplitudeSmooth(bit1Amplitude[i], outputBlock, sendVolume, 0, samplesPerFrameOut, fId, nMarkerFrames);
+                        addTone(i, true, fId, nMarkerFrames);
                     }
                 }
             } else {
@@ -404,18 +1547,44 @@ struct DataRxTx {
                 hasData = false;
             }
 
+            // the tones are summed, shaped by the envelope, scaled and converted in one pass
             if (nFreq == 0) nFreq = 1;
-            float scale = 1.0f/nFreq;
-            for (int i = 0; i < samplesPerFrameOut; ++i) {
-                outputBlock[i] *= scale;
+            float gain = 32000.0f/nFreq;
+            if (txIFFT && txNPerCycle > 0) {
+                ::IFFTReal(txSpectrum.data(), txFrame.data(), samplesPerFrame);
+                txTones[nTxTones++] = txFrame.data();
+            } else {
+                gain *= sendVolume;
             }
 
-            for (int i = 0; i < samplesPerFrameOut; ++i) {
-                outputBlock16[frameId*samplesPerFrameOut + i] = std::round(32000.0*outputBlock[i]);
+            if (nTxTones > 0) {
+                if (txCycleMod != txEnvelopeCycleMod || txNPerCycle != txEnvelopeNPerCycle) {
+                    ::getToneEnvelope(txEnvelope.data(), samplesPerFrameOut, txCycleMod, txNPerCycle);
+                    txEnvelopeCycleMod = txCycleMod;
+                    txEnvelopeNPerCycle = txNPerCycle;
+                }
+                ::getSIMDKernels().mixFrame(txTones.data(), nTxTones, txEnvelope.data(), gain, outputBlock16.data(), samplesPerFrameOut);
+            } else {
+                std::fill(outputBlock16.begin(), outputBlock16.begin() + samplesPerFrameOut, 0);
             }
+            playbackRing.push(outputBlock16.data(), samplesPerFrameOut);
             ++frameId;
+
+            // a transmission that does not fit in the cache is not recorded
+            if (txKey.empty() == false) {
+                if ((txRecording.size() + samplesPerFrameOut)*sizeof(int16_t) > ::kWaveformCacheSize_bytes) {
+                    txKey.clear();
+                    std::vector<int16_t>().swap(txRecording);
+                } else {
+                    txRecording.insert(txRecording.end(), outputBlock16.begin(), outputBlock16.begin() + samplesPerFrameOut);
+                }
+            }
+
+            if (hasData == false && txKey.empty() == false) {
+                ::getWaveformCache().insert(txKey, std::make_shared<const std::vector<int16_t>>(std::move(txRecording)));
+                txRecording.clear();
+            }
         }
-        SDL_QueueAudio(devid_out, outputBlock16.data(), 2*frameId*samplesPerFrameOut);
     }
 
     void receive() {
@@ -423,46 +1592,55 @@ struct DataRxTx {
         static float tSum_ms = 0.0f;
         auto tCallStart = std::chrono::high_resolution_clock::now();
 
-        if (needUpdate) {
+        // the parameters the analysis decodes with change only once it is done
+        if (needUpdate && analysisPending == false) {
             init(0, "");
             needUpdate = false;
         }
 
         while (hasData == false) {
-            // read capture data
-            int nBytesRecorded = SDL_DequeueAudio(devid_in, sampleAmplitude.data(), samplesPerFrame*sampleSizeBytes);
-            if (nBytesRecorded != 0) {
+            // read capture data. The frame is a view into the capture ring, which keeps
+            // the history frames until they leave the history
+            auto & captureRing = ::getCaptureRing();
+            const float * sampleAmplitude = captureRing.read(samplesPerFrame);
+            if (sampleAmplitude != nullptr) {
+                int nBytesRecorded = samplesPerFrame*sampleSizeBytes;
                 {
+                    captureRing.release(::kMaxSpectrumHistory*samplesPerFrame);
+
                     sampleAmplitudeHistory[historyId] = sampleAmplitude;
+                    std::fill(markerBinValid.begin() + historyId*markerBank.bins.size(),
+                              markerBinValid.begin() + (historyId + 1)*markerBank.bins.size(), false);
 
                     if (++historyId >= ::kMaxSpectrumHistory) {
                         historyId = 0;
                     }
 
-                    if (historyId == 0 && (receivingData == false || (receivingData && txMode == ::TxMode::VariableLength))) {
-                        std::fill(sampleAmplitudeAverage.begin(), sampleAmplitudeAverage.end(), 0.0f);
-                        for (auto & s : sampleAmplitudeHistory) {
-                            for (int i = 0; i < samplesPerFrame; ++i) {
-                                sampleAmplitudeAverage[i] += s[i];
-                            }
-                        }
-                        float norm = 1.0f/::kMaxSpectrumHistory;
+                    // the history average is tested for a marker on every frame
+                    if (receivingData == false || (receivingData && txMode == ::TxMode::VariableLength)) {
+                        // total spectrum energy, from the samples (Parseval)
+                        double fsum = 0.0;
                         for (int i = 0; i < samplesPerFrame; ++i) {
-                            sampleAmplitudeAverage[i] *= norm;
+                            fsum += sampleAmplitude[i]*sampleAmplitude[i];
                         }
+                        fsum *= samplesPerFrame;
 
-                        // calculate spectrum
-                        std::copy(sampleAmplitudeAverage.begin(), sampleAmplitudeAverage.begin() + samplesPerFrame, fftIn.data());
-
-                        FFT(fftIn.data(), fftOut.data(), samplesPerFrame, 1.0);
+                        // calculate the full spectrum only if the detector bank suspects a marker
+                        if (hasMarker(receivingData)) {
+                            std::fill(sampleAmplitudeAverage.begin(), sampleAmplitudeAverage.end(), 0.0f);
+                            for (auto & s : sampleAmplitudeHistory) {
+                                for (int i = 0; i < samplesPerFrame; ++i) {
+                                    sampleAmplitudeAverage[i] += s[i];
+                                }
+                            }
+                            float norm = 1.0f/::kMaxSpectrumHistory;
+                            for (int i = 0; i < samplesPerFrame; ++i) {
+                                sampleAmplitudeAverage[i] *= norm;
+                            }
 
-                        double fsum = 0.0;
-                        for (int i = 0; i < samplesPerFrame; ++i) {
-                            sampleSpectrum[i] = (fftOut[i].real()*fftOut[i].real() + fftOut[i].imag()*fftOut[i].imag());
-                            fsum += sampleSpectrum[i];
-                        }
-                        for (int i = 1; i < samplesPerFrame/2; ++i) {
-                            sampleSpectrum[i] += sampleSpectrum[samplesPerFrame - i];
+                            calcPowerSpectrum(sampleAmplitudeAverage.data(), fftOut.data(), sampleSpectrum.data(), samplesPerFrame);
+                        } else {
+                            std::fill(sampleSpectrum.begin(), sampleSpectrum.begin() + samplesPerFrame/2 + 1, 0.0f);
                         }
 
                         if (fsum < 1e-10) {
@@ -473,148 +1651,45 @@ struct DataRxTx {
                     }
 
                     if (framesLeftToRecord > 0) {
-                        std::copy(sampleAmplitude.begin(),
-                                  sampleAmplitude.begin() + samplesPerFrame,
-                                  recordedAmplitude.data() + (framesToRecord - framesLeftToRecord)*samplesPerFrame);
-
-                        if (--framesLeftToRecord <= 0) {
+                        addStepSpectra(nRecordedFrames++, sampleAmplitude);
+                        demodulateCandidates(false);
+
+                        if (decodeStream()) {
+                            rxData = streamWorker.rxData;
+                            rxLength = streamWorker.decodedLength;
+                            printDecoded(streamWorker.decodedLength);
+                            framesToRecord = 0;
+                            framesLeftToRecord = 0;
+                            receivingData = false;
+                            std::fill(sampleSpectrum.begin(), sampleSpectrum.end(), 0.0f);
+                        } else if (--framesLeftToRecord <= 0) {
+                            demodulateCandidates(true);
                             std::fill(sampleSpectrum.begin(), sampleSpectrum.end(), 0.0f);
                             analyzingData = true;
                         }
                     }
                 }
 
-                if (analyzingData) {
-                    int nBytesPerTx = nDataBitsPerTx/8;
-                    int stepsPerFrame = 16;
-                    int step = samplesPerFrame/stepsPerFrame;
-
-                    int offsetStart = 0;
-
-                    framesToAnalyze = nMarkerFrames*stepsPerFrame;
-                    framesLeftToAnalyze = framesToAnalyze;
-
-                    bool isValid = false;
-                    //for (int ii = nMarkerFrames*stepsPerFrame/2; ii < (nMarkerFrames + nPostMarkerFrames)*stepsPerFrame; ++ii) {
-                    for (int ii = nMarkerFrames*stepsPerFrame - 1; ii >= nMarkerFrames*stepsPerFrame/2; --ii) {
-                        offsetStart = ii;
-                        bool knownLength = txMode == ::TxMode::FixedLength;
-                        int encodedOffset = (txMode == ::TxMode::FixedLength) ? 0 : 3;
-
-                        for (int itx = 0; itx < 1024; ++itx) {
-                            int offsetTx = offsetStart + itx*framesPerTx*stepsPerFrame;
-                            if (offsetTx >= recvDuration_frames*stepsPerFrame) {
-                                break;
-                            }
-
-                            std::copy(
-                                recordedAmplitude.begin() + offsetTx*step,
-                                recordedAmplitude.begin() + offsetTx*step + samplesPerFrame, fftIn.data());
-
-                            for (int k = 1; k < framesPerTx-1; ++k) {
-                                for (int i = 0; i < samplesPerFrame; ++i) {
-                                    fftIn[i] += recordedAmplitude[(offsetTx + k*stepsPerFrame)*step + i];
-                                }
-                            }
-
-                            FFT(fftIn.data(), fftOut.data(), samplesPerFrame, 1.0);
-
-                            for (int i = 0; i < samplesPerFrame; ++i) {
-                                sampleSpectrum[i] = (fftOut[i].real()*fftOut[i].real() + fftOut[i].imag()*fftOut[i].imag());
-                            }
-                            for (int i = 1; i < samplesPerFrame/2; ++i) {
-                                sampleSpectrum[i] += sampleSpectrum[samplesPerFrame - i];
-                            }
-
-                            uint8_t curByte = 0;
-                            if (paramFreqDelta > 1) {
-                                for (int i = 0; i < nDataBitsPerTx; ++i) {
-                                    int k = i%8;
-                                    int bin = std::round(dataFreqs_hz[i]*ihzPerFrame);
-                                    if (sampleSpectrum[bin] > 1*sampleSpectrum[bin + d0]) {
-                                        curByte += 1 << k;
-                                    } else if (sampleSpectrum[bin + d0] > 1*sampleSpectrum[bin]) {
-                                    } else {
-                                    }
-                                    if (k == 7) {
-                                        encodedData[itx*nBytesPerTx + i/8] = curByte;
-                                        curByte = 0;
-                                    }
-                                }
-                            } else {
-                                for (int i = 0; i < 2*nBytesPerTx; ++i) {
-                                    int bin = std::round(dataFreqs_hz[0]*ihzPerFrame) + i*16;
-
-                                    int kmax = 0;
-                                    double amax = 0.0;
-                                    for (int k = 0; k < 16; ++k) {
-                                        if (sampleSpectrum[bin + k] > amax) {
-                                            kmax = k;
-                                            amax = sampleSpectrum[bin + k];
-                                        }
-                                    }
-
-                                    if (i%2) {
-                                        curByte += (kmax << 4);
-                                        encodedData[itx*nBytesPerTx + i/2] = curByte;
-                                        curByte = 0;
-                                    } else {
-                                        curByte = kmax;
-                                    }
-                                }
-                            }
-
-                            if (txMode == ::TxMode::VariableLength) {
-                                if (itx*nBytesPerTx > 3 && knownLength == false) {
-                                    if ((rsLength->Decode(encodedData.data(), rxData.data()) == 0) && (rxData[0] <= 140)) {
-                                        knownLength = true;
-                                    } else {
-                                        break;
-                                    }
-                                }
-                            }
-                        }
-
-                        if (txMode == ::TxMode::VariableLength && knownLength) {
-                            if (rsData) delete rsData;
-                            rsData = new RS::ReedSolomon(rxData[0], ::getECCBytesForLength(rxData[0]));
-                        }
-
-                        if (knownLength) {
-                            int decodedLength = rxData[0];
-                            if (rsData->Decode(encodedData.data() + encodedOffset, rxData.data()) == 0) {
-                                printf("Decoded length = %d\n", decodedLength);
-                                if (txMode == ::TxMode::FixedLength && rxData[0] == 'A') {
-                                    printf("[ANSWER] Received sound data successfully!\n");
-                                } else if (txMode == ::TxMode::FixedLength && rxData[0] == 'O') {
-                                    printf("[OFFER]  Received sound data successfully!\n");
-                                } else {
-                                    std::string s((char *) rxData.data(), decodedLength);
-                                    printf("Received sound data successfully: '%s'\n", s.c_str());
-                                }
-                                framesToRecord = 0;
-                                isValid = true;
-                            }
-                        }
-
-                        if (isValid) {
-                            break;
-                        }
-                        --framesLeftToAnalyze;
-                    }
-
-                    if (isValid == false) {
-                        printf("Failed to capture sound data. Please try again\n");
-                        framesToRecord = -1;
-                    }
+                if (analysisHandedOver && analysisPending == false) {
+                    finishAnalysis();
+                }
 
+                // the finished recording goes to the analysis with its candidates, and
+                // the detection of the next transmission resumes right away. Only a
+                // recording that ends while the previous one is analyzed waits for it
+                if (analyzingData && analysisHandedOver == false) {
+                    std::swap(rxCandidates, analysisCandidates);
                     receivingData = false;
                     analyzingData = false;
+                    analysisHandedOver = true;
 
-                    std::fill(sampleSpectrum.begin(), sampleSpectrum.end(), 0.0f);
-
-                    framesToAnalyze = 0;
-                    framesLeftToAnalyze = 0;
+                    if (requestAnalysis) {
+                        analysisPending = true;
+                        requestAnalysis();
+                    } else {
+                        analyze();
+                        finishAnalysis();
+                    }
                 }
 
                 // check if receiving data
@@ -635,14 +1710,15 @@ struct DataRxTx {
                         std::time_t timestamp = std::time(nullptr);
                         printf("%sReceiving sound data ...\n", std::asctime(std::localtime(&timestamp)));
                         rxData.fill(0);
+                        rxLength = 0;
                         receivingData = true;
-                        if (txMode == ::TxMode::FixedLength) {
-                            recvDuration_frames = nMarkerFrames + nPostMarkerFrames + framesPerTx*((::kDefaultFixedLength + paramECCBytesPerTx)/paramBytesPerTx + 1);
-                        } else {
-                            recvDuration_frames = nMarkerFrames + nPostMarkerFrames + framesPerTx*((::kMaxLength + ::getECCBytesForLength(::kMaxLength))/paramBytesPerTx + 1);
-                        }
+                        recvDuration_frames = getMaxRecvDuration_frames();
                         framesToRecord = recvDuration_frames;
                         framesLeftToRecord = recvDuration_frames;
+                        nRecordedFrames = 0;
+                        rxCandidates.clear();
+                        streamFailed = false;
+                        std::fill(stepSpectra.begin(), stepSpectra.begin() + dataBank.bins.size(), 0.0f);
                     }
                 } else if (txMode == ::TxMode::VariableLength) {
                     bool isEnded = true;
@@ -657,7 +1733,7 @@ struct DataRxTx {
                         }
                     }
 
-                    if (isEnded && framesToRecord > 1) {
+                    if (isEnded && framesToRecord > 1 && framesLeftToRecord > 0) {
                         std::time_t timestamp = std::time(nullptr);
                         printf("%sReceived end marker\n", std::asctime(std::localtime(&timestamp)));
                         recvDuration_frames -= framesLeftToRecord - 1;
@@ -679,9 +1755,798 @@ struct DataRxTx {
             nCalls = 0;
         }
 
-        if ((int) SDL_GetQueuedAudioSize(devid_in) > 32*sampleSizeBytes*samplesPerFrame) {
-            printf("nIter = %d, Queue size: %d\n", nIterations, SDL_GetQueuedAudioSize(devid_in));
-            SDL_ClearQueuedAudio(devid_in);
+        const int nOverruns = ::getCaptureRing().overruns();
+        if (nOverruns != nCaptureOverruns) {
+            printf("nIter = %d, Capture overruns: %d, Ring size: %d\n", nIterations, nOverruns, ::getCaptureRing().size());
+            nCaptureOverruns = nOverruns;
+        }
+    }
+
+    // Searches the finished recording for the data, on the candidates handed over
+    // in analysisCandidates. Runs on the analysis thread of the native runtime,
+    // and inline in receive() when there is none. Leaves the worker holding the
+    // decoded data in analysisWorker, or nullptr
+    void analyze() {
+        int stepsPerFrame = ::kStepsPerFrame;
+
+        framesToAnalyze = nMarkerFrames*stepsPerFrame;
+        framesLeftToAnalyze = framesToAnalyze;
+
+        auto & pool = ::getWorkerPool();
+        if ((int) rxWorkers.size() < pool.size()) {
+            rxWorkers.resize(pool.size());
+        }
+
+        // the plain decodes of the single codewords are done first, in batches.
+        // Only the candidates before the first one decoded this way are left
+        const int nCandidates = analysisCandidates.size();
+        const int firstDecoded = decodeCandidatesBatch(rxWorkers[0]);
+
+        // the rest of the candidates are tried in parallel. A worker stops taking
+        // new candidates once one with a higher priority has been decoded, so the
+        // winner is the same one the sequential search would pick
+        std::atomic<int> nextCandidate(0);
+        std::atomic<int> bestCandidate(firstDecoded);
+        pool.run([&](int workerId) {
+            auto & worker = rxWorkers[workerId];
+            worker.decodedCandidate = -1;
+            worker.rxData.fill(0);
+
+            while (true) {
+                int c = nextCandidate++;
+                if (c >= bestCandidate) break;
+
+                if (decodeCandidate(c, worker, batchStatus[c] == 1)) {
+                    worker.decodedCandidate = c;
+                    int best = bestCandidate;
+                    while (c < best && bestCandidate.compare_exchange_weak(best, c) == false);
+                    break;
+                }
+            }
+        });
+
+        if (bestCandidate == firstDecoded && firstDecoded < nCandidates) {
+            decodeCandidate(firstDecoded, rxWorkers[0]);
+            rxWorkers[0].decodedCandidate = firstDecoded;
+        }
+
+        analysisWorker = nullptr;
+        for (auto & worker : rxWorkers) {
+            if (worker.decodedCandidate == bestCandidate) {
+                analysisWorker = &worker;
+                break;
+            }
+        }
+
+        if (analysisWorker == nullptr) {
+            analysisWorker = chaseSearch();
+        }
+
+        framesToAnalyze = 0;
+        framesLeftToAnalyze = 0;
+
+        analysisPending = false;
+    }
+
+    // Takes the result of the analysis, on the Rx side. The failure is shown only
+    // if no new recording has started since
+    void finishAnalysis() {
+        if (analysisWorker) {
+            rxData = analysisWorker->rxData;
+            rxLength = analysisWorker->decodedLength;
+            printDecoded(rxLength);
+        } else {
+            printf("Failed to capture sound data. Please try again\n");
+        }
+
+        if (receivingData == false) {
+            framesToRecord = analysisWorker ? 0 : -1;
+        }
+
+        analysisCandidates.clear();
+        analysisHandedOver = false;
+    }
+
+    // Drops the captured samples that were not received yet, like the capture of
+    // our own transmission. The history frames are released with them, so the
+    // history restarts from silence
+    void clearCapture() {
+        ::getCaptureRing().clear();
+        sampleAmplitudeHistory.fill(sampleAmplitudeSilence.data());
+        std::fill(markerBinValid.begin(), markerBinValid.end(), false);
+    }
+
+    // Value of marker bin b of history frame h. Each frame is transformed on first
+    // use only, and the result is reused by every history window containing it
+    const std::complex<float> & markerBin(int h, int b) {
+        const int id = h*markerBank.bins.size() + b;
+        if (markerBinValid[id] == false) {
+            markerBinHistory[id] = markerBank.eval(sampleAmplitudeHistory[h], b);
+            markerBinValid[id] = true;
+        }
+        return markerBinHistory[id];
+    }
+
+    // Power of marker bin b of the history average. The DFT is linear, so the
+    // average of the per-frame bins is the bin of the averaged frame
+    float markerPower(int b) {
+        std::complex<float> sum = 0.0f;
+        for (int h = 0; h < ::kMaxSpectrumHistory; ++h) {
+            sum += markerBin(h, b);
+        }
+        return markerBank.power(sum*(1.0f/::kMaxSpectrumHistory), b);
+    }
+
+    // Tests the marker bins of the history average on the detector bank. The test
+    // stops at the first bit pair that does not match. The "1" bits require a 3x
+    // dominant tone and rarely match noise, so they are tested first - without a
+    // marker usually only the bins of the first pair are needed
+    bool hasMarker(bool isEnd) {
+        for (int pass = 0; pass < 2; ++pass) {
+            for (int i = 0; i < nBitsInMarker; ++i) {
+                const bool isBit1 = (i%2 == 0) != isEnd;
+                if (isBit1 != (pass == 0)) continue;
+
+                float p0 = markerPower(2*i + 0);
+                float p1 = markerPower(2*i + 1);
+
+                if (isBit1) {
+                    if (p0 <= 3.0f*p1) return false;
+                } else {
+                    if (p0 >= 3.0f*p1) return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    int getMaxRecvDuration_frames() const {
+        if (txMode == ::TxMode::FixedLength) {
+            return nMarkerFrames + nPostMarkerFrames + framesPerTx*((::kDefaultFixedLength + paramECCBytesPerTx)/paramBytesPerTx + 1);
+        }
+
+        return nMarkerFrames + nPostMarkerFrames + framesPerTx*((::kMaxLength + ::getECCBytesForLength(::kMaxLength))/paramBytesPerTx + 1);
+    }
+
+    // The recording is sized for a single codeword. Once the length header of a
+    // longer payload is decoded at step offsetStart, the recording is extended to
+    // its encoded length
+    void extendRecording(int offsetStart, int encodedLength) {
+        const int nFrames = (offsetStart + ::kStepsPerFrame - 1)/::kStepsPerFrame + framesPerTx*(encodedLength/paramBytesPerTx + 2);
+        if (nFrames <= recvDuration_frames) return;
+
+        const int nExtra = nFrames - recvDuration_frames;
+        recvDuration_frames += nExtra;
+        framesToRecord += nExtra;
+        framesLeftToRecord += nExtra;
+    }
+
+    // Rows of the step spectra that are kept. The offsets are ranked on the rows
+    // of the start marker, and every symbol is demodulated as soon as its last
+    // frame is in, so only the latest rows are needed
+    int getStepRows() const {
+        return std::max(nMarkerFrames + 2, framesPerTx + 1)*::kStepsPerFrame + 1;
+    }
+
+    // Row q of the step spectra, in a ring of getStepRows() rows
+    const std::complex<float> * getStepRow(int q) const {
+        const int nBins = dataBank.bins.size();
+        return stepSpectra.data() + (q%(stepSpectra.size()/nBins))*nBins;
+    }
+
+    std::complex<float> * getStepRow(int q) {
+        return const_cast<std::complex<float> *>(static_cast<const DataRxTx *>(this)->getStepRow(q));
+    }
+
+    // The analysis tries many alignments of the recording, each one summing
+    // framesPerTx-1 windows on a grid of samplesPerFrame/kStepsPerFrame samples.
+    // The DFT is linear, so the data bins of each grid step are evaluated once,
+    // while the frame is recorded, and kept as running sums: the spectrum of any
+    // run of steps is then the difference of two rows
+    void addStepSpectra(int frame, const float * samples) {
+        const int nBins = dataBank.bins.size();
+        const int step = samplesPerFrame/::kStepsPerFrame;
+        for (int j = 0; j < ::kStepsPerFrame; ++j) {
+            const int q = frame*::kStepsPerFrame + j;
+            const float * src = samples + j*step;
+            const std::complex<float> * prev = getStepRow(q);
+            std::complex<float> * cur = getStepRow(q + 1);
+            for (int b = 0; b < nBins; ++b) {
+                cur[b] = prev[b] + dataBank.evalRange(src, b, j*step, step);
+            }
+        }
+    }
+
+    // Power spectrum at the data bins of the steps [q0, q1) of the recording. The
+    // steps past the recorded frames count as silence
+    void calcStepWindowSpectrum(int q0, int q1, float * spectrum) const {
+        const int nBins = dataBank.bins.size();
+        const int nSteps = nRecordedFrames*::kStepsPerFrame;
+        const std::complex<float> * s0 = getStepRow(std::min(q0, nSteps));
+        const std::complex<float> * s1 = getStepRow(std::min(q1, nSteps));
+        for (int b = 0; b < nBins; ++b) {
+            spectrum[dataBank.bins[b]] = dataBank.power(s1[b] - s0[b], b);
+        }
+    }
+
+    // Ranks the data offsets in [offsetMin, offsetMax] by the correlation of the
+    // start marker energy around them with the end of the marker envelope. The
+    // marker fades out over its last 15% (see getToneEnvelope). The energy is
+    // the excess of the marker tones over their complementary tones, which is zero
+    // on average in the data that follows. It is measured on one frame windows of
+    // the step spectra, so the test is insensitive to the tone phases
+    std::vector<int> rankOffsets(int offsetMin, int offsetMax) const {
+        const int nSteps = nRecordedFrames*::kStepsPerFrame;
+        const int nRamp = 0.15f*nMarkerFrames*::kStepsPerFrame;
+        const int dMin = -nRamp - ::kStepsPerFrame;
+        const int dMax = ::kStepsPerFrame;
+
+        // the windows of the demodulator cover framesPerTx-1 of the framesPerTx
+        // frames of a symbol, so they are best started half a frame after the data
+        const int dCenter = ::kStepsPerFrame/2;
+
+        // expected marker energy of the window starting d steps after the data start
+        std::vector<float> expected(dMax - dMin);
+        float mean = 0.0f;
+        for (int d = dMin; d < dMax; ++d) {
+            float a = 0.0f;
+            for (int s = d; s < d + ::kStepsPerFrame; ++s) {
+                if (s < 0) a += std::min(1.0f, ((float) -s)/nRamp);
+            }
+            expected[d - dMin] = a*a;
+            mean += a*a;
+        }
+        mean /= expected.size();
+        for (auto & e : expected) e -= mean;
+
+        const int qMin = std::max(0, offsetMin - dCenter + dMin);
+        const int qMax = std::min(nSteps - ::kStepsPerFrame, offsetMax - dCenter + dMax);
+        std::vector<float> energy(std::max(0, qMax - qMin + 1), 0.0f);
+        for (int q = qMin; q <= qMax; ++q) {
+            const std::complex<float> * s0 = getStepRow(q);
+            const std::complex<float> * s1 = getStepRow(q + ::kStepsPerFrame);
+            for (int i = 0; i < (int) markerDataBins.size(); i += 2) {
+                const int b0 = markerDataBins[i + 0];
+                const int b1 = markerDataBins[i + 1];
+                energy[q - qMin] += std::norm(s1[b0] - s0[b0]) - std::norm(s1[b1] - s0[b1]);
+            }
+        }
+
+        std::vector<std::pair<float, int>> scores;
+        for (int offset = offsetMax; offset >= offsetMin; --offset) {
+            float score = 0.0f;
+            for (int d = dMin; d < dMax; ++d) {
+                const int q = offset - dCenter + d;
+                if (q < qMin || q > qMax) continue;
+                score += expected[d - dMin]*energy[q - qMin];
+            }
+            scores.emplace_back(-score, -offset);
+        }
+        std::sort(scores.begin(), scores.end());
+
+        std::vector<int> res;
+        for (const auto & s : scores) {
+            res.push_back(-s.second);
+        }
+
+        return res;
+    }
+
+    // Scratch buffers and RS codecs of one worker of the offset search. The codecs
+    // keep their working polynomials in the instance, so they cannot be shared
+    struct RxWorker {
+        std::array<std::uint8_t, ::kMaxEncodedSize> rxData;
+        std::array<std::uint8_t, ::kMaxEncodedSize> encodedData;
+        std::array<float, ::kMaxEncodedSize> confidence;
+        std::array<std::uint8_t, ::kMaxDataSize> erasures;
+        std::array<std::uint8_t, ::kMaxEncodedSize> encodedAlt;
+        std::array<std::uint8_t, ::kMaxDataSize> blockEncoded;
+        std::array<float, ::kMaxDataSize> blockConfidence;
+        std::array<int, ::kMaxLongLength/::kMaxLength + 1> blockStatus;
+        std::array<std::uint8_t, SoftDecode::kChaseSymbols> chasePositions;
+        std::array<std::uint8_t, ::kMaxDataSize*SoftDecode::kChaseBatch> chaseEncoded;
+        std::array<std::uint8_t, ::kMaxDataSize*SoftDecode::kChaseBatch> chaseDecoded;
+        std::array<int, SoftDecode::kChaseBatch> chaseStatus;
+
+        ::RSCodec rsData;
+        ::RSCodec rsLength;
+
+        int decodedCandidate = -1;
+        int decodedLength = 0;
+
+        int chaseCandidate = -1;
+        int nChaseSymbols = 0;
+    };
+
+    // Demodulated bytes of one candidate data offset, filled in while the frames
+    // are recorded. The bytes past the demodulated symbols are zero, with zero
+    // confidence
+    struct RxCandidate {
+        int offset = 0;
+        int nTx = 0;
+        int nBytes = 0;
+        int decodedLength = -1;
+
+        std::vector<std::uint8_t> encodedData;
+        std::vector<std::uint8_t> encodedAlt;
+        std::vector<float> confidence;
+    };
+
+    // Returns the worker codec for the given lengths, swapping it through the pool
+    // if the lengths changed
+    static RS::ReedSolomon & getRS(::RSCodec & rs, int msgLength, int eccLength) {
+        if (!rs || rs->msg_length != msgLength || rs->ecc_length != eccLength) {
+            rs.reset();
+            rs = ::getRSCodecPool().acquire(msgLength, eccLength);
+        }
+
+        return *rs;
+    }
+
+    // Demodulates the symbol itx, whose windows start at step offsetTx of the
+    // recording, into the encoded data of the candidate
+    void demodulateTx(int offsetTx, int itx, RxCandidate & candidate) {
+        int nBytesPerTx = nDataBitsPerTx/8;
+        int stepsPerFrame = ::kStepsPerFrame;
+
+        auto & sampleSpectrum = candidateSpectrum;
+        auto & encodedData = candidate.encodedData;
+        auto & confidence = candidate.confidence;
+        auto & encodedAlt = candidate.encodedAlt;
+        const bool hasAlt = encodedAlt.empty() == false;
+
+        calcStepWindowSpectrum(offsetTx, offsetTx + (framesPerTx - 1)*stepsPerFrame, sampleSpectrum.data());
+
+        // the confidence of a byte is the smallest ratio of the chosen tone energy
+        // over the energy of the best rejected tone, among the bits or nibbles of it.
+        // The alternative byte takes the rejected tone of that least confident part
+        uint8_t curByte = 0;
+        uint8_t curAlt = 0;
+        float curConfidence = 0.0f;
+        if (paramFreqDelta > 1) {
+            for (int i = 0; i < nDataBitsPerTx; ++i) {
+                int k = i%8;
+                int bin = std::round(dataFreqs_hz[i]*ihzPerFrame);
+                float a1 = sampleSpectrum[bin];
+                float a0 = sampleSpectrum[bin + d0];
+                if (a1 > 1*a0) {
+                    curByte += 1 << k;
+                } else if (a0 > 1*a1) {
+                } else {
+                }
+                float c = std::max(a0, a1)/(std::min(a0, a1) + 1e-12f);
+                if (k == 0 || c < curConfidence) {
+                    curConfidence = c;
+                    curAlt = 1 << k;
+                }
+                if (k == 7) {
+                    encodedData[itx*nBytesPerTx + i/8] = curByte;
+                    if (hasAlt) encodedAlt[itx*nBytesPerTx + i/8] = curByte ^ curAlt;
+                    confidence[itx*nBytesPerTx + i/8] = curConfidence;
+                    curByte = 0;
+                }
+            }
+        } else {
+            for (int i = 0; i < 2*nBytesPerTx; ++i) {
+                int bin = std::round(dataFreqs_hz[0]*ihzPerFrame) + i*16;
+
+                int kmax = 0;
+                int kmax2 = 0;
+                double amax = 0.0;
+                double amax2 = 0.0;
+                for (int k = 0; k < 16; ++k) {
+                    if (sampleSpectrum[bin + k] > amax) {
+                        kmax2 = kmax;
+                        kmax = k;
+                        amax2 = amax;
+                        amax = sampleSpectrum[bin + k];
+                    } else if (sampleSpectrum[bin + k] > amax2) {
+                        kmax2 = k;
+                        amax2 = sampleSpectrum[bin + k];
+                    }
+                }
+                float c = amax/(amax2 + 1e-12f);
+
+                if (i%2) {
+                    curByte += (kmax << 4);
+                    encodedData[itx*nBytesPerTx + i/2] = curByte;
+                    if (c < curConfidence) {
+                        curConfidence = c;
+                        curAlt = (curByte & 0x0F) | (kmax2 << 4);
+                    } else {
+                        curAlt |= (kmax << 4);
+                    }
+                    if (hasAlt) encodedAlt[itx*nBytesPerTx + i/2] = curAlt;
+                    confidence[itx*nBytesPerTx + i/2] = curConfidence;
+                    curByte = 0;
+                } else {
+                    curByte = kmax;
+                    curAlt = kmax2;
+                    curConfidence = c;
+                }
+            }
+        }
+    }
+
+    // Decodes the length header of VariableLength data into decodedLength, once
+    // its kMaxHeaderLength bytes are in. A zero length is never sent, and is
+    // rejected: its codeword would accept any data with few enough nonzero bytes
+    bool decodeLength(RxWorker & worker) const {
+        auto & rs = getRS(worker.rsLength, 1, 2);
+        uint8_t header[2];
+        if (rs.Decode(worker.encodedData.data(), header) != 0) return false;
+        if (header[0] <= ::kMaxLength) {
+            worker.decodedLength = header[0];
+            return worker.decodedLength > 0;
+        }
+
+        if (rs.Decode(worker.encodedData.data() + 3, header + 1) != 0) return false;
+        if (header[1] <= ::kMaxLength) return false;
+        worker.decodedLength = (header[0] - ::kMaxLength - 1)*::kLongLengthBase + header[1] - ::kMaxLength - 1;
+        return worker.decodedLength > ::kMaxLength && worker.decodedLength <= ::kMaxLongLength;
+    }
+
+    // Number of encoded bytes of the data, including the length header
+    int getEncodedLength(int decodedLength) const {
+        if (txMode == ::TxMode::FixedLength) {
+            return ::kDefaultFixedLength + nECCBytesPerTx;
+        }
+
+        return ::getEncodedLengthForLength(decodedLength);
+    }
+
+    // Returns the worker codec of the data with the given VariableLength length
+    RS::ReedSolomon & getDataRS(RxWorker & worker, int length) const {
+        if (txMode == ::TxMode::FixedLength) {
+            return getRS(worker.rsData, ::kDefaultFixedLength, nECCBytesPerTx);
+        }
+
+        const auto layout = ::getBlockLayout(length);
+        return getRS(worker.rsData, layout.msgLength, layout.eccLength);
+    }
+
+    // Decodes the encoded data of the worker. For VariableLength data the length
+    // must already be decoded. The codewords that fail the plain decode are retried
+    // with erasures. The interleaved codewords of a long payload are the layout of
+    // DecodeBatch, so they are decoded together, in place, and each one lands at
+    // its offset of the payload. With isPlainFailed the plain decode of a single
+    // codeword is known to fail, and only the erasures are tried
+    bool decodeData(RxWorker & worker, bool isPlainFailed = false) const {
+        auto & encodedData = worker.encodedData;
+        auto & rxData = worker.rxData;
+
+        if (txMode == ::TxMode::FixedLength) {
+            worker.decodedLength = ::kDefaultFixedLength;
+        }
+
+        auto & rs = getDataRS(worker, worker.decodedLength);
+        if (txMode == ::TxMode::FixedLength || worker.decodedLength <= ::kMaxLength) {
+            int encodedOffset = (txMode == ::TxMode::FixedLength) ? 0 : 3;
+            if ((isPlainFailed || rs.Decode(encodedData.data() + encodedOffset, rxData.data()) != 0) &&
+                SoftDecode::decodeErasures(rs, encodedData.data() + encodedOffset, worker.confidence.data() + encodedOffset, rxData.data(), worker.erasures.data()) == false) {
+                return false;
+            }
+
+            // an earlier attempt on a long payload may have left data past the message
+            std::fill(rxData.begin() + rs.msg_length, rxData.end(), 0);
+            return true;
+        }
+
+        const auto layout = ::getBlockLayout(worker.decodedLength);
+        const int nEncoded = layout.msgLength + layout.eccLength;
+        const uint8_t * encoded = encodedData.data() + ::getHeaderLength(worker.decodedLength);
+        const float * confidence = worker.confidence.data() + ::getHeaderLength(worker.decodedLength);
+
+        rs.DecodeBatch(encoded, layout.nBlocks, layout.nBlocks, rxData.data(), worker.blockStatus.data());
+        for (int b = 0; b < layout.nBlocks; ++b) {
+            if (worker.blockStatus[b] == 0) continue;
+
+            for (int k = 0; k < nEncoded; ++k) {
+                worker.blockEncoded[k] = encoded[k*layout.nBlocks + b];
+                worker.blockConfidence[k] = confidence[k*layout.nBlocks + b];
+            }
+            if (SoftDecode::decodeErasures(rs, worker.blockEncoded.data(), worker.blockConfidence.data(), rxData.data() + b*layout.msgLength, worker.erasures.data()) == false) {
+                return false;
+            }
+        }
+
+        std::fill(rxData.begin() + layout.nBlocks*layout.msgLength, rxData.end(), 0);
+
+        return true;
+    }
+
+    // Number of bytes demodulated at candidate c, given its decoded length. Only
+    // the length header is demodulated until it is decoded, except at the best
+    // ranked candidates, where the Chase search tries the alternatives of the
+    // header bytes for any single codeword
+    int getCandidateBytes(int c, int decodedLength) const {
+        if (txMode == ::TxMode::FixedLength || decodedLength > 0) {
+            return getEncodedLength(decodedLength);
+        }
+
+        return (c < ::kSyncCandidates) ? getEncodedLength(::kMaxLength) : ::kMaxHeaderLength;
+    }
+
+    // The alternative bytes are kept only where the Chase search may use them:
+    // at the best ranked candidates, and not for long payloads
+    void resizeCandidate(int c, RxCandidate & candidate, int nBytes) const {
+        int nBytesPerTx = nDataBitsPerTx/8;
+        int n = ((nBytes + nBytesPerTx - 1)/nBytesPerTx)*nBytesPerTx;
+        bool keepAlt = c < ::kSyncCandidates && nBytes <= getEncodedLength(::kMaxLength);
+
+        candidate.nBytes = nBytes;
+        candidate.encodedData.resize(n, 0);
+        candidate.encodedAlt.resize(keepAlt ? n : 0, 0);
+        candidate.encodedAlt.shrink_to_fit();
+        candidate.confidence.resize(n, 0.0f);
+    }
+
+    // Demodulates the symbols of the candidate offsets, as soon as their frames
+    // are recorded. The candidates are ranked once the end of the start marker is
+    // in, on the rows kept of the start of the recording. At the end of the
+    // recording the remaining symbols are demodulated with the frames past it as
+    // silence. The length header of each candidate is decoded as soon as it is
+    // in, and the recording is extended to the longest length announced by any
+    // candidate, as the best ranked offsets may be misaligned and miss the header
+    void demodulateCandidates(bool isLast) {
+        int nBytesPerTx = nDataBitsPerTx/8;
+        int stepsPerFrame = ::kStepsPerFrame;
+
+        if (rxCandidates.empty()) {
+            if (nRecordedFrames < nMarkerFrames + 2 && isLast == false) return;
+
+            // the offsets that best match the end of the start marker are tried
+            // first, the rest follow in the order of the exhaustive search
+            const int offsetFirst = nMarkerFrames*stepsPerFrame - 1;
+            const int nCandidates = nMarkerFrames*stepsPerFrame/2;
+            std::vector<int> offsets = rankOffsets(offsetFirst - nCandidates + 1, offsetFirst);
+            offsets.resize(std::min(nCandidates, ::kSyncCandidates));
+            for (int ii = offsetFirst; ii > offsetFirst - nCandidates; --ii) {
+                if (std::find(offsets.begin(), offsets.end(), ii) == offsets.end()) {
+                    offsets.push_back(ii);
+                }
+            }
+
+            rxCandidates.resize(offsets.size());
+            for (int c = 0; c < (int) offsets.size(); ++c) {
+                rxCandidates[c].offset = offsets[c];
+                resizeCandidate(c, rxCandidates[c], getCandidateBytes(c, -1));
+            }
+        }
+
+        const int nSteps = nRecordedFrames*stepsPerFrame;
+        for (int c = 0; c < (int) rxCandidates.size(); ++c) {
+            auto & candidate = rxCandidates[c];
+            while (candidate.nTx*nBytesPerTx < candidate.nBytes) {
+                int offsetTx = candidate.offset + candidate.nTx*framesPerTx*stepsPerFrame;
+                if (offsetTx >= nSteps) break;
+                if (isLast == false && offsetTx + (framesPerTx - 1)*stepsPerFrame > nSteps) break;
+
+                demodulateTx(offsetTx, candidate.nTx, candidate);
+                ++candidate.nTx;
+
+                if (txMode == ::TxMode::VariableLength && candidate.decodedLength < 0 && candidate.nTx*nBytesPerTx >= ::kMaxHeaderLength) {
+                    std::copy(candidate.encodedData.begin(), candidate.encodedData.begin() + ::kMaxHeaderLength, streamWorker.encodedData.begin());
+                    candidate.decodedLength = decodeLength(streamWorker) ? streamWorker.decodedLength : 0;
+                    resizeCandidate(c, candidate, getCandidateBytes(c, candidate.decodedLength));
+                    if (candidate.decodedLength > 0) {
+                        extendRecording(candidate.offset, candidate.nBytes);
+                    }
+                }
+            }
+        }
+    }
+
+    // Copies the demodulated bytes of the candidate into the worker
+    static void loadCandidate(const RxCandidate & candidate, RxWorker & worker) {
+        std::copy(candidate.encodedData.begin(), candidate.encodedData.end(), worker.encodedData.begin());
+        std::copy(candidate.encodedAlt.begin(), candidate.encodedAlt.end(), worker.encodedAlt.begin());
+        std::copy(candidate.confidence.begin(), candidate.confidence.end(), worker.confidence.begin());
+        worker.decodedLength = candidate.decodedLength;
+    }
+
+    // Decodes the data of analyzed candidate c. Uses only the scratch buffers of
+    // the worker
+    bool decodeCandidate(int c, RxWorker & worker, bool isPlainFailed = false) const {
+        if (txMode == ::TxMode::VariableLength && analysisCandidates[c].decodedLength <= 0) return false;
+
+        loadCandidate(analysisCandidates[c], worker);
+
+        return decodeData(worker, isPlainFailed);
+    }
+
+    // Length of the data of analyzed candidate c, 0 if it is not known
+    int getCandidateLength(int c) const {
+        if (txMode == ::TxMode::FixedLength) {
+            return ::kDefaultFixedLength;
+        }
+
+        return std::max(0, analysisCandidates[c].decodedLength);
+    }
+
+    // Plain decode of the candidates whose data is a single codeword. The ones
+    // with the same length are decoded together, as one batch of codewords laid
+    // out byte by byte, up to the first one that decodes. The result of candidate c
+    // is left in batchStatus[c]: 0 if it decoded, 1 if it did not, -1 if it was
+    // not tried. Returns the first candidate that decoded, or the number of
+    // candidates
+    int decodeCandidatesBatch(RxWorker & worker) {
+        const int nCandidates = analysisCandidates.size();
+        const int encodedOffset = (txMode == ::TxMode::FixedLength) ? 0 : 3;
+
+        batchStatus.assign(nCandidates, -1);
+        batchIndex.resize(nCandidates);
+        batchEncoded.resize(nCandidates*::kMaxDataSize);
+        batchDecoded.resize(nCandidates*::kMaxDataSize);
+        batchResult.resize(nCandidates);
+
+        int res = nCandidates;
+        for (int c = 0; c < res; ++c) {
+            const int length = getCandidateLength(c);
+            if (batchStatus[c] != -1 || length == 0 || length > ::kMaxLength) continue;
+
+            int nBatch = 0;
+            for (int i = c; i < res; ++i) {
+                if (getCandidateLength(i) == length) {
+                    batchIndex[nBatch++] = i;
+                }
+            }
+
+            auto & rs = getDataRS(worker, length);
+            const int nEncoded = rs.msg_length + rs.ecc_length;
+            for (int j = 0; j < nBatch; ++j) {
+                const auto & encoded = analysisCandidates[batchIndex[j]].encodedData;
+                for (int k = 0; k < nEncoded; ++k) {
+                    batchEncoded[k*nBatch + j] = encoded[encodedOffset + k];
+                }
+            }
+
+            int first = rs.DecodeBatch(batchEncoded.data(), nBatch, nBatch, batchDecoded.data(), batchResult.data(), true);
+            for (int j = 0; j < nBatch; ++j) {
+                batchStatus[batchIndex[j]] = batchResult[j];
+            }
+            if (first >= 0) {
+                res = batchIndex[first];
+            }
+        }
+
+        return res;
+    }
+
+    // Streaming counterpart of the candidate search, called after each recorded
+    // frame. The best ranked candidate is decoded right after its last symbol is
+    // demodulated. Returns true on success. If this fails, the full search runs
+    // when the recording is done
+    bool decodeStream() {
+        int nBytesPerTx = nDataBitsPerTx/8;
+
+        if (streamFailed || rxCandidates.empty()) return false;
+
+        const auto & candidate = rxCandidates[0];
+        if (txMode == ::TxMode::VariableLength && candidate.decodedLength <= 0) {
+            streamFailed = candidate.decodedLength == 0;
+            return false;
+        }
+
+        if (candidate.nTx*nBytesPerTx < candidate.nBytes) return false;
+
+        loadCandidate(candidate, streamWorker);
+        if (decodeData(streamWorker) == false) {
+            streamFailed = true;
+            return false;
+        }
+
+        return true;
+    }
+
+    // Prepares the Chase search at candidate c: decodes the length header,
+    // trying the alternatives of its bytes as well, and picks the least confident
+    // bytes of the data. Only the first header codeword is searched, as the
+    // interleaved codewords of a long payload are not
+    void prepareChase(int c, RxWorker & worker) const {
+        worker.nChaseSymbols = 0;
+        if (analysisCandidates[c].encodedAlt.empty()) return;
+
+        loadCandidate(analysisCandidates[c], worker);
+
+        int encodedOffset = 0;
+        worker.decodedLength = ::kDefaultFixedLength;
+        if (txMode == ::TxMode::VariableLength) {
+            const int nHeader = ::getHeaderLength(::kMaxLength);
+            const uint8_t header[] = { 0, 1, 2 };
+
+            bool knownLength = false;
+            for (int mask = 0; mask < (1 << nHeader) && knownLength == false; ++mask) {
+                SoftDecode::swapAlternatives(worker.encodedData.data(), worker.encodedAlt.data(), header, nHeader, mask);
+                knownLength = decodeLength(worker);
+                SoftDecode::swapAlternatives(worker.encodedData.data(), worker.encodedAlt.data(), header, nHeader, mask);
+            }
+
+            if (knownLength == false || worker.decodedLength > ::kMaxLength) return;
+
+            encodedOffset = nHeader;
+        }
+
+        const auto & rs = getDataRS(worker, worker.decodedLength);
+        worker.nChaseSymbols = SoftDecode::getChasePositions(rs, worker.confidence.data() + encodedOffset, worker.chasePositions.data(), worker.erasures.data());
+    }
+
+    // Decodes the hypotheses of the prepared worker given by the masks
+    bool decodeChase(const int * masks, int nMasks, RxWorker & worker) const {
+        int encodedOffset = (txMode == ::TxMode::FixedLength) ? 0 : ::getHeaderLength(::kMaxLength);
+        auto & rs = getDataRS(worker, worker.decodedLength);
+
+        return SoftDecode::decodeChase(rs, worker.encodedData.data() + encodedOffset, worker.encodedAlt.data() + encodedOffset,
+                                       worker.chasePositions.data(), worker.nChaseSymbols, masks, nMasks,
+                                       worker.chaseEncoded.data(), worker.chaseDecoded.data(), worker.chaseStatus.data(), worker.rxData.data());
+    }
+
+    // Chase decoding of the best ranked offsets, tried after the plain search
+    // fails. The byte decisions of the demodulator are kept together with the
+    // best rejected alternative, and every hypothesis flips a different subset
+    // of the least confident bytes. The hypotheses are decoded in parallel, in
+    // batches of kChaseBatch and in the order of the offsets, until one succeeds
+    // or the time budget runs out.
+    // Returns the worker holding the decoded data, or nullptr
+    RxWorker * chaseSearch() {
+        auto tStart = std::chrono::high_resolution_clock::now();
+
+        const auto & masks = SoftDecode::getChaseMasks();
+        const int nMasks = masks.size();
+        const int nBatches = (nMasks + SoftDecode::kChaseBatch - 1)/SoftDecode::kChaseBatch;
+        const int nJobs = std::min((int) analysisCandidates.size(), ::kSyncCandidates)*nBatches;
+
+        auto & pool = ::getWorkerPool();
+        std::atomic<int> nextJob(0);
+        std::atomic<int> bestJob(nJobs);
+        pool.run([&](int workerId) {
+            auto & worker = rxWorkers[workerId];
+            worker.decodedCandidate = -1;
+            worker.chaseCandidate = -1;
+            worker.rxData.fill(0);
+
+            while (true) {
+                int job = nextJob++;
+                if (job >= bestJob) break;
+
+                auto tNow = std::chrono::high_resolution_clock::now();
+                if (::getTime_ms(tStart, tNow) > ::kChaseBudget_ms) break;
+
+                int c = job/nBatches;
+                int iMask = (job%nBatches)*SoftDecode::kChaseBatch;
+                if (worker.chaseCandidate != c) {
+                    prepareChase(c, worker);
+                    worker.chaseCandidate = c;
+                }
+
+                if (decodeChase(masks.data() + iMask, std::min(SoftDecode::kChaseBatch, nMasks - iMask), worker)) {
+                    worker.decodedCandidate = job;
+                    int best = bestJob;
+                    while (job < best && bestJob.compare_exchange_weak(best, job) == false);
+                    break;
+                }
+            }
+        });
+
+        for (auto & worker : rxWorkers) {
+            if (worker.decodedCandidate == bestJob) {
+                return &worker;
+            }
+        }
+
+        return nullptr;
+    }
+
+    void printDecoded(int decodedLength) const {
+        printf("Decoded length = %d\n", decodedLength);
+        if (txMode == ::TxMode::FixedLength && rxData[0] == 'A') {
+            printf("[ANSWER] Received sound data successfully!\n");
+        } else if (txMode == ::TxMode::FixedLength && rxData[0] == 'O') {
+            printf("[OFFER]  Received sound data successfully!\n");
+        } else {
+            std::string s((char *) rxData.data(), decodedLength);
+            printf("Received sound data successfully: '%s'\n", s.c_str());
         }
     }
 
@@ -692,41 +2557,83 @@ struct DataRxTx {
     int paramFreqStart = 40;
     int paramFramesPerTx = 6;
     int paramBytesPerTx = 2;
-    int paramECCBytesPerTx = 32;
+    int paramECCBytesPerTx = ::kDefaultFixedECCLength;
     int paramVolume = 10;
 
     // Rx
     bool receivingData;
     bool analyzingData;
 
-    std::array<float, kMaxSamplesPerFrame> fftIn;
-    std::array<std::complex<float>, kMaxSamplesPerFrame> fftOut;
+    // Hands the finished recording to the analysis thread, if there is one. The
+    // recording goes with its candidates, so that the next one can start while it
+    // is analyzed. While analysisPending is set, the analysis owns
+    // analysisCandidates, analysisWorker, the batch buffers and rxWorkers
+    std::function<void()> requestAnalysis;
+    std::atomic<bool> analysisPending{false};
+    bool analysisHandedOver = false;
 
-    ::AmplitudeData sampleAmplitude;
-    ::SpectrumData sampleSpectrum;
+    std::array<std::complex<float>, kMaxSamplesPerFrame/2 + 1> fftOut;
 
-    std::array<std::uint8_t, ::kMaxDataSize> rxData;
-    std::array<std::uint8_t, ::kMaxDataSize> encodedData;
+    ::SpectrumData sampleSpectrum;
+    ::SparseDFTBank markerBank;
+    std::vector<std::complex<float>> markerBinHistory;
+    std::vector<bool> markerBinValid;
+    ::SparseDFTBank dataBank;
+    std::vector<std::complex<float>> stepSpectra;
+    std::vector<RxCandidate> rxCandidates;
+    std::vector<RxCandidate> analysisCandidates;
+    RxWorker * analysisWorker = nullptr;
+    ::SpectrumData candidateSpectrum;
+    std::vector<int> batchIndex;
+    std::vector<int> batchStatus;
+    std::vector<int> batchResult;
+    std::vector<std::uint8_t> batchEncoded;
+    std::vector<std::uint8_t> batchDecoded;
+    std::vector<RxWorker> rxWorkers;
+    std::vector<int> markerDataBins;
+
+    RxWorker streamWorker;
+    bool streamFailed = false;
+
+    std::array<std::uint8_t, ::kMaxEncodedSize> rxData;
+    std::array<std::uint8_t, ::kMaxEncodedSize> encodedData;
+    int rxLength = 0;
 
     int historyId = 0;
     ::AmplitudeData sampleAmplitudeAverage;
-    std::array<::AmplitudeData, ::kMaxSpectrumHistory> sampleAmplitudeHistory;
-
-    ::RecordedData recordedAmplitude;
+    std::array<const float *, ::kMaxSpectrumHistory> sampleAmplitudeHistory;
+    ::AmplitudeData sampleAmplitudeSilence;
 
     // Tx
-    bool hasData;
+    std::atomic<bool> hasData{false};
     int sampleSizeBytes;
     float sampleRate;
     float sampleRateOut;
     int samplesPerFrame;
     float isamplesPerFrame;
 
-    ::AmplitudeData outputBlock;
-    ::AmplitudeData16 outputBlock16;
-
-    std::array<::AmplitudeData, ::kMaxDataBits> bit1Amplitude;
-    std::array<::AmplitudeData, ::kMaxDataBits> bit0Amplitude;
+    std::array<int16_t, ::kMaxSamplesPerFrame> outputBlock16;
+
+    std::string txKey;
+    std::vector<int16_t> txRecording;
+    ::Waveform txWaveform;
+    int txWaveformPos = 0;
+
+    std::vector<::AmplitudeData> bit1Amplitude;
+    std::vector<::AmplitudeData> bit0Amplitude;
+    std::vector<int> bit1Frame;
+    std::vector<int> bit0Frame;
+
+    bool txIFFT = false;
+    int txCycleMod = 0;
+    int txNPerCycle = 0;
+    int nTxTones = 0;
+    std::array<const float *, 2*::kMaxDataBits> txTones;
+    int txEnvelopeCycleMod = -1;
+    int txEnvelopeNPerCycle = -1;
+    ::AmplitudeData txEnvelope;
+    std::array<std::complex<float>, kMaxSamplesPerFrame/2 + 1> txSpectrum;
+    ::AmplitudeData txFrame;
 
     float sendVolume;
     float hzPerFrame;
@@ -751,6 +2658,7 @@ struct DataRxTx {
     int nMarkerFrames;
     int nPostMarkerFrames;
     int recvDuration_frames;
+    int nRecordedFrames = 0;
 
     ::TxMode txMode = ::TxMode::FixedLength;
 
@@ -762,18 +2670,32 @@ struct DataRxTx {
     int nECCBytesPerTx;
     int sendDataLength;
 
-    RS::ReedSolomon * rsData = nullptr;
-    RS::ReedSolomon * rsLength = nullptr;
-
     float averageRxTime_ms = 0.0;
+    int nCaptureOverruns = 0;
 
     std::string textToSend;
 };
 
+// Runs on the SDL audio thread and only pushes the captured samples to the ring
+void cbCapture(void * userdata, Uint8 * stream, int len) {
+    auto & ring = *(::CaptureRing *)(userdata);
+    ring.push((const float *)(stream), len/sizeof(float));
+}
+
+// Runs on the SDL audio thread and plays the generated samples, or silence when
+// there are none
+void cbPlayback(void * userdata, Uint8 * stream, int len) {
+    auto & ring = *(::PlaybackRing *)(userdata);
+    const int n = len/sizeof(int16_t);
+    const int nPopped = ring.pop((int16_t *)(stream), n);
+    std::fill((int16_t *)(stream) + nPopped, (int16_t *)(stream) + n, 0);
+}
+
 int init() {
     if (g_isInitialized) return 0;
 
     printf("Initializing ...\n");
+    printf("Using %s SIMD kernels\n", ::getSIMDKernels().name);
 
     SDL_LogSetPriority(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_INFO);
 
@@ -805,8 +2727,9 @@ int init() {
     desiredSpec.freq = ::kBaseSampleRate;
     desiredSpec.format = AUDIO_S16SYS;
     desiredSpec.channels = 1;
-    desiredSpec.samples = 16*1024;
-    desiredSpec.callback = NULL;
+    desiredSpec.samples = 1024;
+    desiredSpec.callback = cbPlayback;
+    desiredSpec.userdata = &::getPlaybackRing();
 
     SDL_AudioSpec obtainedSpec;
     SDL_zero(obtainedSpec);
@@ -842,6 +2765,8 @@ int init() {
     captureSpec.freq = ::kBaseSampleRate;
     captureSpec.format = AUDIO_F32SYS;
     captureSpec.samples = 1024;
+    captureSpec.callback = cbCapture;
+    captureSpec.userdata = &::getCaptureRing();
 
     if (g_playbackId >= 0) {
         printf("Attempt to open capture device %d : '%s' ...\n", g_captureId, SDL_GetAudioDeviceName(g_captureId, SDL_FALSE));
@@ -879,25 +2804,54 @@ int init() {
     //}
 
     g_data = new DataRxTx(obtainedSpec.freq, ::kBaseSampleRate, captureSpec.samples, sampleSizeBytes, "");
+#ifndef __EMSCRIPTEN__
+    // the Tx thread synthesizes with its own instance, so that it never waits for the Rx side
+    g_dataTx = new DataRxTx(obtainedSpec.freq, ::kBaseSampleRate, captureSpec.samples, sampleSizeBytes, "");
+#endif
+    printf("Memory footprint: %d kB\n", (int) (g_data->getMemoryFootprint_bytes()/1024));
 
     g_isInitialized = true;
     return 0;
 }
 
+#ifndef __EMSCRIPTEN__
+static ::BoundedQueue<std::string> g_txQueue(4);
+static ::BoundedQueue<int> g_analysisQueue(1);
+#endif
+
 // JS interface
 extern "C" {
     int setText(int textLength, const char * text) {
+#ifndef __EMSCRIPTEN__
+        if (g_dataTx) {
+            g_txQueue.push(std::string(text, textLength));
+            return 0;
+        }
+#endif
         g_data->init(textLength, text);
         return 0;
     }
 
     int getText(char * text) {
-        std::copy(g_data->rxData.begin(), g_data->rxData.end(), text);
+        std::copy(g_data->rxData.begin(), g_data->rxData.begin() + ::kMaxDataSize, text);
+        return 0;
+    }
+
+    // getText copies kMaxDataSize bytes, longer payloads are read with getLongText
+    // into a buffer of getTextLength() bytes
+    int getTextLength() { return g_data->rxLength; }
+    int getLongText(char * text) {
+        std::copy(g_data->rxData.begin(), g_data->rxData.begin() + g_data->rxLength, text);
         return 0;
     }
 
     int getSampleRate() { return g_data->sampleRate; }
     float getAverageRxTime_ms() { return g_data->averageRxTime_ms; }
+    int getCaptureOverruns() { return ::getCaptureRing().overruns(); }
+    int getMemoryFootprint_bytes() { return g_data->getMemoryFootprint_bytes(); }
+    int getWaveformCacheHits() { return ::getWaveformCache().hits(); }
+    int getWaveformCacheMisses() { return ::getWaveformCache().misses(); }
+    int getRSCodecAllocations() { return ::getRSCodecPool().allocated(); }
     int getFramesToRecord() { return g_data->framesToRecord; }
     int getFramesLeftToRecord() { return g_data->framesLeftToRecord; }
     int getFramesToAnalyze() { return g_data->framesToAnalyze; }
@@ -905,7 +2859,11 @@ extern "C" {
     int hasDeviceOutput() { return devid_out; }
     int hasDeviceCapture() { return (g_totalBytesCaptured > 0) ? devid_in : 0; }
     int doInit() { return init(); }
-    int setTxMode(int txMode) { g_data->txMode = (::TxMode)(txMode); return 0; }
+    int setTxMode(int txMode) {
+        g_data->txMode = (::TxMode)(txMode);
+        if (g_dataTx) g_dataTx->txMode = (::TxMode)(txMode);
+        return 0;
+    }
 
     void setParameters(
         int paramFreqDelta,
@@ -923,6 +2881,14 @@ extern "C" {
         g_data->paramVolume = paramVolume;
 
         g_data->needUpdate = true;
+
+        if (g_dataTx) {
+            g_dataTx->paramFreqDelta = paramFreqDelta;
+            g_dataTx->paramFreqStart = paramFreqStart;
+            g_dataTx->paramFramesPerTx = paramFramesPerTx;
+            g_dataTx->paramBytesPerTx = paramBytesPerTx;
+            g_dataTx->paramVolume = paramVolume;
+        }
     }
 }
 
@@ -938,18 +2904,19 @@ void update() {
         }
     }
 
+#ifdef __EMSCRIPTEN__
     if (g_data->hasData == false) {
         SDL_PauseAudioDevice(devid_out, SDL_FALSE);
 
         static auto tLastNoData = std::chrono::high_resolution_clock::now();
         auto tNow = std::chrono::high_resolution_clock::now();
 
-        if ((int) SDL_GetQueuedAudioSize(devid_out) < g_data->samplesPerFrame*g_data->sampleSizeBytes) {
+        if (::getPlaybackRing().size() == 0) {
             SDL_PauseAudioDevice(devid_in, SDL_FALSE);
             if (::getTime_ms(tLastNoData, tNow) > 500.0f) {
                 g_data->receive();
             } else {
-                SDL_ClearQueuedAudio(devid_in);
+                g_data->clearCapture();
             }
         } else {
             tLastNoData = tNow;
@@ -957,11 +2924,12 @@ void update() {
             //SDL_Delay(10);
         }
     } else {
-        SDL_PauseAudioDevice(devid_out, SDL_TRUE);
+        SDL_PauseAudioDevice(devid_out, SDL_FALSE);
         SDL_PauseAudioDevice(devid_in, SDL_TRUE);
 
         g_data->send();
     }
+#endif
 
     if (shouldTerminate) {
         SDL_PauseAudioDevice(devid_in, 1);
@@ -976,6 +2944,51 @@ void update() {
     }
 }
 
+#ifndef __EMSCRIPTEN__
+// Native runtime. The stages run on their own threads, connected by bounded queues:
+//  - capture:  the SDL audio callback fills the capture ring
+//  - Rx:       per-frame marker detection, recording and streaming decode
+//  - analysis: offset search of the recordings the streaming decode missed
+//  - Tx:       synthesis of the sent texts, a few frames ahead of playback
+// update() on the main thread only handles the SDL events
+void runRx() {
+    auto tLastNoData = std::chrono::high_resolution_clock::now();
+    while (true) {
+        auto tNow = std::chrono::high_resolution_clock::now();
+
+        // the capture of our own transmission and its echo is discarded
+        if (g_dataTx->hasData || ::getPlaybackRing().size() > 0) {
+            tLastNoData = tNow;
+            g_data->clearCapture();
+        } else if (::getTime_ms(tLastNoData, tNow) > 500.0f) {
+            g_data->receive();
+        } else {
+            g_data->clearCapture();
+        }
+
+        SDL_Delay(1);
+    }
+}
+
+void runAnalysis() {
+    while (true) {
+        g_analysisQueue.pop();
+        g_data->analyze();
+    }
+}
+
+void runTx() {
+    while (true) {
+        std::string text = g_txQueue.pop();
+        g_dataTx->init(text.size(), text.data());
+        while (g_dataTx->hasData) {
+            g_dataTx->send();
+            SDL_Delay(1);
+        }
+    }
+}
+#endif
+
 static std::map<std::string, std::string> parseCmdArguments(int argc, char ** argv) {
     int last = argc;
     std::map<std::string, std::string> res;
@@ -1053,6 +3066,15 @@ int main(int argc, char** argv) {
             }
     };
     printf("\n");
+
+    g_data->requestAnalysis = []() { g_analysisQueue.push(0); };
+    SDL_PauseAudioDevice(devid_in, SDL_FALSE);
+    SDL_PauseAudioDevice(devid_out, SDL_FALSE);
+
+    std::thread rxThread(runRx);
+    std::thread analysisThread(runAnalysis);
+    std::thread txThread(runTx);
+
     std::thread inputThread([]() {
         std::string inputOld = "";
         while (true) {
@@ -1076,6 +3098,9 @@ int main(int argc, char** argv) {
     }
 
     inputThread.join();
+    txThread.join();
+    analysisThread.join();
+    rxThread.join();
 #endif
 
     delete g_data;
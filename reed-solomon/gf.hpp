@@ -15,6 +15,17 @@
 #define assert(dummy)
 #endif
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RS_GF_SSSE3_DISPATCH
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define RS_GF_NEON
+#include <arm_neon.h>
+#elif defined(__wasm_simd128__)
+#define RS_GF_WASM_SIMD
+#include <wasm_simd128.h>
+#endif
+
 
 namespace RS {
 
@@ -110,6 +121,129 @@ inline uint8_t mul(uint16_t x, uint16_t y){
     return exp[log[x] + log[y]];
 }
 
+/* Compile time versions of the multiplication and of the powers of 2 */
+constexpr uint8_t xtime_c(uint8_t x) {
+    return (uint8_t) ((x << 1) ^ ((x & 0x80) ? 0x1d : 0));
+}
+
+constexpr uint8_t mul_c(uint8_t x, uint8_t y) {
+    return y == 0 ? 0 : (uint8_t) (((y & 1) ? x : 0) ^ mul_c(xtime_c(x), y >> 1));
+}
+
+constexpr uint8_t pow2_c(int power) {
+    return power == 0 ? 1 : xtime_c(pow2_c(power - 1));
+}
+
+/* Products of every constant with the low and the high nibbles:
+ * c*x = lo[c][x & 0xf] ^ hi[c][x >> 4], since the multiplication is linear over xor */
+struct MulTables {
+    uint8_t lo[256][16];
+    uint8_t hi[256][16];
+};
+
+inline MulTables make_mul_tables() {
+    MulTables t;
+    for(int c = 0; c < 256; c++) {
+        for(int x = 0; x < 16; x++) {
+            t.lo[c][x] = mul(c, x);
+            t.hi[c][x] = mul(c, x << 4);
+        }
+    }
+    return t;
+}
+
+inline const MulTables& mul_tables() {
+    static const MulTables tables = make_mul_tables();
+    return tables;
+}
+
+/* @brief Multiply-accumulate of a region by a constant: dst[i] ^= c*src[i]
+ * @param *dst - destination region
+ * @param *src - source region, not overlapping dst
+ * @param c    - constant
+ * @param n    - region length */
+inline void mul_add_region_scalar(uint8_t* dst, const uint8_t* src, uint8_t c, int n) {
+    if(c == 0) return;
+    const uint16_t lc = log[c];
+    for(int i = 0; i < n; i++) {
+        if(src[i] != 0)
+            dst[i] ^= exp[lc + log[src[i]]];
+    }
+}
+
+/* The SIMD kernels look up both nibbles of 16 bytes at once in the tables of c,
+ * with a byte shuffle */
+#if defined(RS_GF_SSSE3_DISPATCH)
+__attribute__((target("ssse3")))
+inline void mul_add_region_ssse3(uint8_t* dst, const uint8_t* src, uint8_t c, int n) {
+    const MulTables& t = mul_tables();
+    const __m128i lo   = _mm_loadu_si128((const __m128i*) t.lo[c]);
+    const __m128i hi   = _mm_loadu_si128((const __m128i*) t.hi[c]);
+    const __m128i mask = _mm_set1_epi8(0x0f);
+
+    int i = 0;
+    for(; i + 16 <= n; i += 16) {
+        const __m128i x  = _mm_loadu_si128((const __m128i*) (src + i));
+        const __m128i pl = _mm_shuffle_epi8(lo, _mm_and_si128(x, mask));
+        const __m128i ph = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(x, 4), mask));
+        const __m128i d  = _mm_loadu_si128((const __m128i*) (dst + i));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_xor_si128(d, _mm_xor_si128(pl, ph)));
+    }
+    mul_add_region_scalar(dst + i, src + i, c, n - i);
+}
+#elif defined(RS_GF_NEON)
+inline void mul_add_region_neon(uint8_t* dst, const uint8_t* src, uint8_t c, int n) {
+    const MulTables& t = mul_tables();
+    const uint8x16_t lo   = vld1q_u8(t.lo[c]);
+    const uint8x16_t hi   = vld1q_u8(t.hi[c]);
+    const uint8x16_t mask = vdupq_n_u8(0x0f);
+
+    int i = 0;
+    for(; i + 16 <= n; i += 16) {
+        const uint8x16_t x  = vld1q_u8(src + i);
+        const uint8x16_t pl = vqtbl1q_u8(lo, vandq_u8(x, mask));
+        const uint8x16_t ph = vqtbl1q_u8(hi, vshrq_n_u8(x, 4));
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), veorq_u8(pl, ph)));
+    }
+    mul_add_region_scalar(dst + i, src + i, c, n - i);
+}
+#elif defined(RS_GF_WASM_SIMD)
+inline void mul_add_region_wasm(uint8_t* dst, const uint8_t* src, uint8_t c, int n) {
+    const MulTables& t = mul_tables();
+    const v128_t lo   = wasm_v128_load(t.lo[c]);
+    const v128_t hi   = wasm_v128_load(t.hi[c]);
+    const v128_t mask = wasm_i8x16_splat(0x0f);
+
+    int i = 0;
+    for(; i + 16 <= n; i += 16) {
+        const v128_t x  = wasm_v128_load(src + i);
+        const v128_t pl = wasm_i8x16_swizzle(lo, wasm_v128_and(x, mask));
+        const v128_t ph = wasm_i8x16_swizzle(hi, wasm_u8x16_shr(x, 4));
+        wasm_v128_store(dst + i, wasm_v128_xor(wasm_v128_load(dst + i), wasm_v128_xor(pl, ph)));
+    }
+    mul_add_region_scalar(dst + i, src + i, c, n - i);
+}
+#endif
+
+/* @brief Multiply-accumulate of a region by a constant: dst[i] ^= c*src[i],
+ *        with the SIMD kernel supported by the running CPU
+ * @param *dst - destination region
+ * @param *src - source region, not overlapping dst
+ * @param c    - constant
+ * @param n    - region length */
+inline void mul_add_region(uint8_t* dst, const uint8_t* src, uint8_t c, int n) {
+    if(c == 0) return;
+#if defined(RS_GF_SSSE3_DISPATCH)
+    static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+    if(has_ssse3) return mul_add_region_ssse3(dst, src, c, n);
+#elif defined(RS_GF_NEON)
+    return mul_add_region_neon(dst, src, c, n);
+#elif defined(RS_GF_WASM_SIMD)
+    return mul_add_region_wasm(dst, src, c, n);
+#endif
+    mul_add_region_scalar(dst, src, c, n);
+}
+
 /* @brief Division in Galua Fields
  * @param x - dividend
  * @param y - divisor
@@ -185,9 +319,8 @@ poly_mul(const Poly *p, const Poly *q, Poly *newp) {
     /* Compute the polynomial multiplication (just like the outer product of two vectors,
      * we multiply each coefficients of p with all coefficients of q) */
     for(uint8_t j = 0; j < q->length; j++){
-        for(uint8_t i = 0; i < p->length; i++){
-            newp->at(i+j) ^= mul(p->at(i), q->at(j)); /* == r[i + j] = gf_add(r[i+j], gf_mul(p[i], q[j])) */
-        }
+        /* r[i + j] = gf_add(r[i+j], gf_mul(p[i], q[j])) for all i */
+        mul_add_region(newp->ptr() + j, p->ptr(), q->at(j), p->length);
     }
 }
 
@@ -207,12 +340,7 @@ poly_div(const Poly *p, const Poly *q, Poly *newp) {
 
     for(int i = 0; i < (p->length-(q->length-1)); i++){
         coef = newp->at(i);
-        if(coef != 0){
-            for(uint8_t j = 1; j < q->length; j++){
-                if(q->at(j) != 0)
-                    newp->at(i+j) ^= mul(q->at(j), coef);
-            }
-        }
+        mul_add_region(newp->ptr() + i + 1, q->ptr() + 1, coef, q->length - 1);
     }
 
     size_t sep = p->length-(q->length-1);
@@ -20,6 +20,7 @@ namespace RS {
 
 #define MSG_CNT 3   // message-length polynomials count
 #define POLY_CNT 14 // (ecc_length*2)-length polynomialc count
+#define BATCH_CNT 32 // codewords per block of DecodeBatch
 
 class ReedSolomon {
 public:
@@ -29,12 +30,32 @@ public:
     uint8_t * generator_cache = nullptr;
     bool    generator_cached = false;
 
+    /* Powers of the syndrome roots by codeword position: 2^(r*(enc_len-1-k)) at k*ecc_length + r */
+    uint8_t * syndrome_powers = nullptr;
+
+    /* Syndromes of a block of DecodeBatch: syndrome r of codeword i at r*BATCH_CNT + i */
+    uint8_t * batch_syndromes = nullptr;
+
+    /* Polynomials memory of the codewords of DecodeBatch that have errors */
+    uint8_t * batch_memory = nullptr;
+
     ReedSolomon(uint8_t msg_length_p, uint8_t ecc_length_p) :
         msg_length(msg_length_p), ecc_length(ecc_length_p) {
         generator_cache = new uint8_t[ecc_length + 1];
 
         const uint8_t   enc_len  = msg_length + ecc_length;
-        const uint8_t   poly_len = ecc_length * 2;
+
+        batch_syndromes = new uint8_t[ecc_length * BATCH_CNT];
+
+        syndrome_powers = new uint8_t[enc_len * ecc_length];
+        for(int k = 0; k < enc_len; k++) {
+            for(int r = 0; r < ecc_length; r++) {
+                syndrome_powers[k*ecc_length + r] = gf::exp[(r*(enc_len - 1 - k)) % 255];
+            }
+        }
+
+        /* Errata locator times syndromes can take ecc_length*2 + 1 coefficients */
+        const uint8_t   poly_len = ecc_length * 2 + 1;
         uint8_t** memptr   = &memory;
         uint16_t  offset   = 0;
 
@@ -58,10 +79,17 @@ public:
             polynoms[i].Init(i, offset, poly_len, memptr);
             offset += poly_len;
         }
+
+        memory_length = offset;
+
+        batch_memory = new uint8_t[memory_length];
     }
 
-    ~ReedSolomon() {
+    virtual ~ReedSolomon() {
         delete [] generator_cache;
+        delete [] syndrome_powers;
+        delete [] batch_syndromes;
+        delete [] batch_memory;
         // Dummy destructor, gcc-generated one crashes programm
         memory = NULL;
     }
@@ -69,11 +97,11 @@ public:
     /* @brief Message block encoding
      * @param *src - input message buffer      (msg_lenth size)
      * @param *dst - output buffer for ecc     (ecc_length size at least) */
-     void EncodeBlock(const void* src, void* dst) {
+     virtual void EncodeBlock(const void* src, void* dst) {
         assert(msg_length + ecc_length < 256);
 
         /* Allocating memory on stack for polynomials storage */
-        uint8_t stack_memory[MSG_CNT * msg_length + POLY_CNT * ecc_length * 2];
+        uint8_t stack_memory[memory_length];
         this->memory = stack_memory;
 
         const uint8_t* src_ptr = (const uint8_t*) src;
@@ -105,11 +133,7 @@ public:
         uint8_t coef = 0; // cache
         for(uint8_t i = 0; i < msg_length; i++){
             coef = msg_out->at(i);
-            if(coef != 0){
-                for(uint32_t j = 1; j < gen->length; j++){
-                    msg_out->at(i+j) ^= gf::mul(gen->at(j), coef);
-                }
-            }
+            gf::mul_add_region(msg_out->ptr() + i + 1, gen->ptr() + 1, coef, gen->length - 1);
         }
 
         // Copying ECC to the output buffer
@@ -136,9 +160,102 @@ public:
      * @param *erase_pos   - known errors positions
      * @param erase_count  - count of known errors
      * @return RESULT_SUCCESS if successfull, error code otherwise */
-     int DecodeBlock(const void* src, const void* ecc, void* dst, uint8_t* erase_pos = NULL, size_t erase_count = 0) {
+     virtual int DecodeBlock(const void* src, const void* ecc, void* dst, uint8_t* erase_pos = NULL, size_t erase_count = 0) {
         assert(msg_length + ecc_length < 256);
 
+        /* Allocation memory on stack */
+        uint8_t stack_memory[memory_length];
+        return DecodeBlockIn(stack_memory, src, ecc, dst, erase_pos, erase_count);
+    }
+
+    /* @brief Message block decoding
+     * @param *src         - encoded message buffer   (msg_length + ecc_length size)
+     * @param *msg_out     - output buffer            (msg_length size at least)
+     * @param *erase_pos   - known errors positions
+     * @param erase_count  - count of known errors
+     * @return RESULT_SUCCESS if successfull, error code otherwise */
+     int Decode(const void* src, void* dst, uint8_t* erase_pos = NULL, size_t erase_count = 0) {
+         const uint8_t *src_ptr = (const uint8_t*) src;
+         const uint8_t *ecc_ptr = src_ptr + msg_length;
+
+         return DecodeBlock(src, ecc_ptr, dst, erase_pos, erase_count);
+     }
+
+    /* @brief Decoding of many codewords at once. The syndromes of all of them are
+     *        computed together, vectorized over the codewords; the ones without
+     *        errors are done, and only the rest go through the error correction
+     * @param *src          - codewords in structure-of-arrays layout: byte k of codeword i
+     *                        at src[k*stride + i]
+     * @param stride        - distance between the bytes of a codeword (count at least)
+     * @param count         - number of codewords
+     * @param *dst          - output buffer, msg_length bytes per codeword one after another
+     * @param *status       - result per codeword: RESULT_SUCCESS (0), 1 if it could not be
+     *                        decoded, -1 if it was not tried
+     * @param stop_at_first - stop at the first decoded codeword, in index order
+     * @return index of the first decoded codeword, -1 if there is none */
+    int DecodeBatch(const uint8_t* src, size_t stride, int count, uint8_t* dst, int* status, bool stop_at_first = false) {
+        const uint8_t enc_len = msg_length + ecc_length;
+        int first = -1;
+
+        for(int i = 0; i < count; i++) status[i] = -1;
+
+        for(int i0 = 0; i0 < count; i0 += BATCH_CNT) {
+            const int n = (count - i0 < BATCH_CNT) ? count - i0 : BATCH_CNT;
+
+            // syndrome r of all codewords of the block: one region multiply per codeword byte
+            memset(batch_syndromes, 0, ecc_length * BATCH_CNT);
+            for(uint8_t r = 0; r < ecc_length; r++) {
+                uint8_t* synd_r = batch_syndromes + r*BATCH_CNT;
+                for(uint8_t k = 0; k < enc_len; k++) {
+                    gf::mul_add_region(synd_r, src + k*stride + i0, syndrome_powers[k*ecc_length + r], n);
+                }
+            }
+
+            for(int i = 0; i < n; i++) {
+                uint8_t codeword[256];
+                uint8_t synd[256];
+                bool has_errors = false;
+                for(uint8_t k = 0; k < enc_len; k++) {
+                    codeword[k] = src[k*stride + i0 + i];
+                }
+                for(uint8_t r = 0; r < ecc_length; r++) {
+                    synd[r] = batch_syndromes[r*BATCH_CNT + i];
+                    has_errors |= synd[r] != 0;
+                }
+
+                uint8_t* msg = dst + (size_t) (i0 + i)*msg_length;
+                if(has_errors) {
+                    status[i0 + i] = DecodeSyndromes(codeword, synd, msg);
+                } else {
+                    memcpy(msg, codeword, msg_length);
+                    status[i0 + i] = 0;
+                }
+
+                if(status[i0 + i] == 0 && first < 0) {
+                    first = i0 + i;
+                    if(stop_at_first) return first;
+                }
+            }
+        }
+
+        return first;
+    }
+
+protected:
+    /* @brief Decoding of a codeword with known syndromes, without erasures
+     * @param *codeword - encoded message            (msg_length + ecc_length size)
+     * @param *synd     - its syndromes               (ecc_length size)
+     * @param *dst      - output buffer              (msg_length size at least)
+     * @return RESULT_SUCCESS if successfull, error code otherwise */
+    virtual int DecodeSyndromes(const uint8_t* codeword, const uint8_t* synd, uint8_t* dst) {
+        return DecodeBlockIn(batch_memory, codeword, codeword + msg_length, dst, NULL, 0, synd);
+    }
+
+    /* @brief Message block decoding with the given polynomials memory
+     * @param *stack_memory - polynomials memory     (memory_length size at least)
+     * @param *synd_in      - syndromes of the message, computed here if NULL
+     * the other parameters are the ones of DecodeBlock */
+    int DecodeBlockIn(uint8_t* stack_memory, const void* src, const void* ecc, void* dst, uint8_t* erase_pos, size_t erase_count, const uint8_t* synd_in = NULL) {
         const uint8_t *src_ptr = (const uint8_t*) src;
         const uint8_t *ecc_ptr = (const uint8_t*) ecc;
         uint8_t *dst_ptr = (uint8_t*) dst;
@@ -148,8 +265,6 @@ public:
 
         bool ok;
 
-        /* Allocation memory on stack */
-        uint8_t stack_memory[MSG_CNT * msg_length + POLY_CNT * ecc_length * 2];
         this->memory = stack_memory;
 
         Poly *msg_in  = &polynoms[ID_MSG_IN];
@@ -181,7 +296,13 @@ public:
         Poly *forney = &polynoms[ID_FORNEY];
 
         // Calculating syndrome
-        CalcSyndromes(msg_in);
+        if(synd_in != NULL && epos->length == 0) {
+            synd->length = ecc_length + 1;
+            synd->at(0) = 0;
+            memcpy(synd->ptr() + 1, synd_in, ecc_length);
+        } else {
+            CalcSyndromes(msg_in);
+        }
 
         // Checking for errors
         bool has_errors = false;
@@ -196,7 +317,7 @@ public:
         if(!has_errors) goto return_corrected_msg;
 
         CalcForneySyndromes(synd, epos, src_len);
-        FindErrorLocator(forney, NULL, epos->length);
+        if(!FindErrorLocator(forney, NULL, epos->length)) return 1;
 
         // Reversing syndrome
         // TODO optimize through special Poly flag
@@ -210,7 +331,8 @@ public:
         if(!ok) return 1;
 
         // Error happened while finding errors (so helpfull :D)
-        if(err->length == 0) return 1;
+        // With erasures the errata may be the erasures alone
+        if(err->length == 0 && epos->length == 0) return 1;
 
         /* Adding found errors with known */
         for(uint8_t i = 0; i < err->length; i++) {
@@ -218,7 +340,13 @@ public:
         }
 
         // Correcting errors
-        CorrectErrata(synd, epos, msg_in);
+        if(!CorrectErrata(synd, epos, msg_in)) return 1;
+
+        // Checking the corrected message, the errata may be more than we can fix
+        CalcSyndromes(msg_out);
+        for(uint8_t i = 0; i < synd->length; i++) {
+            if(synd->at(i) != 0) return 1;
+        }
 
     return_corrected_msg:
         // Wrighting corrected message to output buffer
@@ -227,21 +355,8 @@ public:
         return 0;
     }
 
-    /* @brief Message block decoding
-     * @param *src         - encoded message buffer   (msg_length + ecc_length size)
-     * @param *msg_out     - output buffer            (msg_length size at least)
-     * @param *erase_pos   - known errors positions
-     * @param erase_count  - count of known errors
-     * @return RESULT_SUCCESS if successfull, error code otherwise */
-     int Decode(const void* src, void* dst, uint8_t* erase_pos = NULL, size_t erase_count = 0) {
-         const uint8_t *src_ptr = (const uint8_t*) src;
-         const uint8_t *ecc_ptr = src_ptr + msg_length;
-
-         return DecodeBlock(src, ecc_ptr, dst, erase_pos, erase_count);
-     }
-
 #ifndef DEBUG
-private:
+protected:
 #endif
 
     enum POLY_ID {
@@ -271,6 +386,7 @@ private:
 
     // Pointer for polynomials memory on stack
     uint8_t* memory;
+    uint16_t memory_length; // Size of the polynomials memory
     Poly polynoms[MSG_CNT + POLY_CNT];
 
     void GeneratorPoly() {
@@ -296,6 +412,16 @@ private:
         Poly *synd = &polynoms[ID_SYNDROMES];
         synd->length = ecc_length+1;
         synd->at(0) = 0;
+
+        // All syndromes at once: each codeword byte adds its multiple of the root powers
+        if(msg->length == msg_length + ecc_length) {
+            memset(synd->ptr() + 1, 0, ecc_length);
+            for(uint8_t k = 0; k < msg->length; k++){
+                gf::mul_add_region(synd->ptr() + 1, syndrome_powers + k*ecc_length, msg->at(k), ecc_length);
+            }
+            return;
+        }
+
         for(uint8_t i = 1; i < ecc_length+1; i++){
             synd->at(i) = gf::poly_eval(msg, gf::pow(2, i-1));
         }
@@ -339,7 +465,7 @@ private:
         gf::poly_div(mulp, divisor, dst);
     }
 
-    void CorrectErrata(const Poly *synd, const Poly *err_pos, const Poly *msg_in) {
+    bool CorrectErrata(const Poly *synd, const Poly *err_pos, const Poly *msg_in) {
         Poly *c_pos     = &polynoms[ID_COEF_POS];
         Poly *corrected = &polynoms[ID_MSG_OUT];
         c_pos->length = err_pos->length;
@@ -409,6 +535,9 @@ private:
                 err_loc_prime = gf::mul(err_loc_prime, err_loc_prime_temp->at(j));
             }
 
+            // Repeated errata positions, can't correct
+            if(err_loc_prime == 0) return false;
+
             y = gf::poly_eval(re_eval, Xi_inv);
             y = gf::mul(gf::pow(X->at(i), 1), y);
 
@@ -416,6 +545,7 @@ private:
         }
 
         gf::poly_add(msg_in, E, corrected);
+        return true;
     }
 
     bool FindErrorLocator(const Poly *synd, Poly *erase_loc = NULL, size_t erase_count = 0) {
@@ -471,10 +601,12 @@ private:
         }
 
         uint32_t shift = 0;
-        while(err_loc->length && err_loc->at(shift) == 0) shift++;
+        while(shift < err_loc->length && err_loc->at(shift) == 0) shift++;
+        if(shift == err_loc->length) return false;
 
+        /* The locator is built from the Forney syndromes, so it holds the errors only */
         uint32_t errs = err_loc->length - shift - 1;
-        if(((errs - erase_count) * 2 + erase_count) > ecc_length){
+        if((errs * 2 + erase_count) > ecc_length){
             return false; /* Error count is greater then we can fix! */
         }
 
@@ -526,6 +658,79 @@ private:
     }
 };
 
+/* Generator polynomial of ecc_length N, computed at compile time:
+ * (x - 2^0)(x - 2^1)...(x - 2^(N-1)), highest degree first, as GeneratorPoly() makes it */
+template <int... Is> struct IndexSeq {};
+template <int N, int... Is> struct MakeIndexSeq : MakeIndexSeq<N - 1, N - 1, Is...> {};
+template <int... Is> struct MakeIndexSeq<0, Is...> { typedef IndexSeq<Is...> type; };
+
+template <int N, class Seq = typename MakeIndexSeq<N + 1>::type> struct Generator;
+
+template <> struct Generator<0, IndexSeq<0>> {
+    static constexpr uint8_t coef[1] = { 1 };
+};
+
+template <int N, int... Is> struct Generator<N, IndexSeq<Is...>> {
+    typedef Generator<N - 1> Prev;
+
+    /* coefficient j of Prev*(x + 2^(N-1)) */
+    static constexpr uint8_t at(int j) {
+        return (j < N ? Prev::coef[j] : 0) ^ (j > 0 ? gf::mul_c(Prev::coef[j - 1], gf::pow2_c(N - 1)) : 0);
+    }
+
+    static constexpr uint8_t coef[N + 1] = { at(Is)... };
+};
+
+template <int N, int... Is> constexpr uint8_t Generator<N, IndexSeq<Is...>>::coef[N + 1];
+
+/* Codec with the lengths fixed at compile time: the generator is a constant, the
+ * polynomials memory has a fixed size and the encoding loops have constant bounds.
+ * Decoding shares the algorithm of ReedSolomon */
+template <uint8_t MsgLen, uint8_t EccLen>
+class ReedSolomonFixed : public ReedSolomon {
+public:
+    static_assert(MsgLen + EccLen < 256, "codeword too long");
+
+    /* Same layout as the ReedSolomon constructor makes */
+    static constexpr uint16_t kMemoryLength = MSG_CNT*(MsgLen + EccLen) + POLY_CNT*(EccLen*2 + 1);
+
+    ReedSolomonFixed() : ReedSolomon(MsgLen, EccLen) {
+        assert(memory_length == kMemoryLength);
+    }
+
+    void EncodeBlock(const void* src, void* dst) override {
+        const uint8_t* gen = Generator<EccLen>::coef;
+
+        uint8_t msg_out[MsgLen + EccLen];
+        memcpy(msg_out, src, MsgLen);
+        memset(msg_out + MsgLen, 0, EccLen);
+
+        for(int i = 0; i < MsgLen; i++) {
+            const uint8_t coef = msg_out[i];
+            if(EccLen >= 16) {
+                gf::mul_add_region(msg_out + i + 1, gen + 1, coef, EccLen);
+            } else if(coef != 0) {
+                for(int j = 0; j < EccLen; j++) {
+                    msg_out[i + 1 + j] ^= gf::mul(gen[j + 1], coef);
+                }
+            }
+        }
+
+        memcpy(dst, msg_out + MsgLen, EccLen);
+    }
+
+    int DecodeBlock(const void* src, const void* ecc, void* dst, uint8_t* erase_pos = NULL, size_t erase_count = 0) override {
+        uint8_t stack_memory[kMemoryLength];
+        return DecodeBlockIn(stack_memory, src, ecc, dst, erase_pos, erase_count);
+    }
+
+protected:
+    int DecodeSyndromes(const uint8_t* codeword, const uint8_t* synd, uint8_t* dst) override {
+        uint8_t stack_memory[kMemoryLength];
+        return DecodeBlockIn(stack_memory, codeword, codeword + MsgLen, dst, NULL, 0, synd);
+    }
+};
+
 }
 
 #endif // RS_HPP
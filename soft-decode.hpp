@@ -0,0 +1,129 @@
+/*! \file soft-decode.hpp
+ *  \brief Soft decision decoding of RS codewords from the byte confidences
+ */
+
+#ifndef SOFT_DECODE_HPP
+#define SOFT_DECODE_HPP
+
+#include "reed-solomon/rs.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace SoftDecode {
+
+constexpr auto kErasureSteps = 2;
+constexpr auto kMinRejectECC = 8;
+constexpr auto kChaseSymbols = 8;
+constexpr auto kChaseBatch = 32;
+
+// Decodes one codeword, passing its least confident bytes as erasures: an
+// erasure takes half the ECC of an unknown error, so when the erased bytes
+// include the wrong ones more of them can be corrected. At most half the ECC
+// is erased, and at least kMinRejectECC bytes are left to reject wrong
+// codewords, so short payloads are not retried: with 4 ECC bytes nearly any
+// noise decodes after 2 erasures. The erasures buffer holds one byte per
+// symbol of the codeword
+inline bool decodeErasures(RS::ReedSolomon & rs, const uint8_t * encoded, const float * confidence, uint8_t * dst, uint8_t * erasures) {
+    const int nEncoded = rs.msg_length + rs.ecc_length;
+    for (int i = 0; i < nEncoded; ++i) {
+        erasures[i] = i;
+    }
+    std::sort(erasures, erasures + nEncoded, [&](uint8_t a, uint8_t b) {
+        return confidence[a] < confidence[b];
+    });
+
+    for (int k = 1; k <= kErasureSteps; ++k) {
+        const int nErasures = (k*rs.ecc_length)/(2*kErasureSteps);
+        if (nErasures == 0 || rs.ecc_length - nErasures < kMinRejectECC) continue;
+
+        if (rs.Decode(encoded, dst, erasures, nErasures) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Hypotheses of the Chase search as subsets of the least confident bytes,
+// fewest flips first
+inline const std::vector<int> & getChaseMasks() {
+    static const std::vector<int> masks = [] {
+        std::vector<int> res;
+        for (int n = 1; n <= kChaseSymbols; ++n) {
+            for (int mask = 1; mask < (1 << kChaseSymbols); ++mask) {
+                int nFlips = 0;
+                for (int j = 0; j < kChaseSymbols; ++j) nFlips += (mask >> j) & 1;
+                if (nFlips == n) res.push_back(mask);
+            }
+        }
+        return res;
+    }();
+
+    return masks;
+}
+
+// Replaces the selected bytes with their alternatives, or restores them when
+// called again with the same positions
+inline void swapAlternatives(uint8_t * encoded, uint8_t * alt, const uint8_t * positions, int nPositions, int mask) {
+    for (int j = 0; j < nPositions; ++j) {
+        if ((mask >> j) & 1) {
+            std::swap(encoded[positions[j]], alt[positions[j]]);
+        }
+    }
+}
+
+// Picks the least confident bytes of a codeword for the Chase search and
+// returns how many. A hypothesis that flips n bytes leaves ecc - 2n bytes to
+// reject wrong codewords, which must stay at least kMinRejectECC as with the
+// erasures, so short payloads are not searched. The scratch buffer holds one
+// byte per symbol of the codeword
+inline int getChasePositions(const RS::ReedSolomon & rs, const float * confidence, uint8_t * positions, uint8_t * scratch) {
+    const int nEncoded = rs.msg_length + rs.ecc_length;
+    const int nPositions = std::min(kChaseSymbols, (rs.ecc_length - kMinRejectECC)/2);
+    if (nPositions <= 0) return 0;
+
+    for (int i = 0; i < nEncoded; ++i) {
+        scratch[i] = i;
+    }
+    std::partial_sort(scratch, scratch + nPositions, scratch + nEncoded, [&](uint8_t a, uint8_t b) {
+        return confidence[a] < confidence[b];
+    });
+    std::copy(scratch, scratch + nPositions, positions);
+
+    return nPositions;
+}
+
+// Decodes the Chase hypotheses given by the masks together, as one batch of at
+// most kChaseBatch codewords laid out byte by byte. Stops at the first one that
+// decodes, in the order of the masks. The batch buffers hold kChaseBatch
+// codewords, and the encoded bytes are restored on return
+inline bool decodeChase(RS::ReedSolomon & rs, uint8_t * encoded, uint8_t * alt, const uint8_t * positions, int nPositions,
+                        const int * masks, int nMasks, uint8_t * batchEncoded, uint8_t * batchDecoded, int * batchStatus, uint8_t * dst) {
+    const int nEncoded = rs.msg_length + rs.ecc_length;
+
+    int nBatch = 0;
+    for (int i = 0; i < nMasks; ++i) {
+        if (masks[i] >= (1 << nPositions)) continue;
+
+        swapAlternatives(encoded, alt, positions, nPositions, masks[i]);
+        for (int k = 0; k < nEncoded; ++k) {
+            batchEncoded[k*kChaseBatch + nBatch] = encoded[k];
+        }
+        swapAlternatives(encoded, alt, positions, nPositions, masks[i]);
+        ++nBatch;
+    }
+    if (nBatch == 0) return false;
+
+    int first = rs.DecodeBatch(batchEncoded, kChaseBatch, nBatch, batchDecoded, batchStatus, true);
+    if (first < 0) return false;
+
+    std::copy(batchDecoded + first*rs.msg_length, batchDecoded + (first + 1)*rs.msg_length, dst);
+
+    return true;
+}
+
+}
+
+#endif
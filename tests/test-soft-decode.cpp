@@ -0,0 +1,83 @@
+/*! \file test-soft-decode.cpp
+ *  \brief Checks that the soft decision decoding rejects noise
+ */
+
+#include "soft-decode.hpp"
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+namespace {
+
+constexpr auto kMaxLength = 140;
+constexpr auto kTrials = 20;
+
+// ECC of the single codeword of a VariableLength payload, as in main.cpp
+int getECCBytesForLength(int len) {
+    return std::max(4, 2*(len/5));
+}
+
+// Runs all the hypotheses of the Chase search on the codeword, in batches
+bool decodeChaseAll(RS::ReedSolomon & rs, uint8_t * encoded, uint8_t * alt, const float * confidence, uint8_t * dst, uint8_t * scratch) {
+    static std::vector<uint8_t> batchEncoded(256*SoftDecode::kChaseBatch);
+    static std::vector<uint8_t> batchDecoded(256*SoftDecode::kChaseBatch);
+    static std::vector<int> batchStatus(SoftDecode::kChaseBatch);
+
+    uint8_t positions[SoftDecode::kChaseSymbols];
+    const int nPositions = SoftDecode::getChasePositions(rs, confidence, positions, scratch);
+
+    const auto & masks = SoftDecode::getChaseMasks();
+    for (int i = 0; i < (int) masks.size(); i += SoftDecode::kChaseBatch) {
+        const int nMasks = std::min(SoftDecode::kChaseBatch, (int) masks.size() - i);
+        if (SoftDecode::decodeChase(rs, encoded, alt, positions, nPositions, masks.data() + i, nMasks,
+                                    batchEncoded.data(), batchDecoded.data(), batchStatus.data(), dst)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+}
+
+// Decodes random codewords with random confidences and alternatives, as noise
+// in place of the data demodulates, the way a short VariableLength payload is
+// decoded: plain, with erasures and with the Chase search. Fails if more than
+// 1 in 1000 of them is accepted, or if any is accepted only by the soft
+// decisions: with the ECC they leave to reject wrong codewords, they should not
+// add to the rate of the plain decode
+int main() {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    std::vector<uint8_t> encoded(256);
+    std::vector<uint8_t> alt(256);
+    std::vector<uint8_t> decoded(256);
+    std::vector<uint8_t> erasures(256);
+    std::vector<float> confidence(256);
+
+    int nDecoded = 0;
+    int nSoftDecoded = 0;
+    for (int len = 1; len <= kMaxLength; ++len) {
+        RS::ReedSolomon rs(len, getECCBytesForLength(len));
+        for (int i = 0; i < kTrials; ++i) {
+            for (int k = 0; k < rs.msg_length + rs.ecc_length; ++k) {
+                encoded[k] = rng();
+                alt[k] = rng();
+                confidence[k] = uniform(rng);
+            }
+            if (rs.Decode(encoded.data(), decoded.data()) == 0) {
+                ++nDecoded;
+            } else if (SoftDecode::decodeErasures(rs, encoded.data(), confidence.data(), decoded.data(), erasures.data()) ||
+                       decodeChaseAll(rs, encoded.data(), alt.data(), confidence.data(), decoded.data(), erasures.data())) {
+                ++nDecoded;
+                ++nSoftDecoded;
+            }
+        }
+    }
+
+    printf("Noise check: %d of %d random codewords decoded, %d of them only by the soft decisions\n", nDecoded, kTrials*kMaxLength, nSoftDecoded);
+
+    return (nSoftDecoded == 0 && nDecoded*1000 < kTrials*kMaxLength) ? 0 : 1;
+}